@@ -1,9 +1,13 @@
 /*
     Рендерим градиентный треугольник и текстурированные квадраты,
-    используя вершинный и индексные буферы.
+    используя вершинный и индексный буферы, общие для всех фигур (GeometryPool).
 */
 
 #include <Urho3D/Urho3DAll.h>
+#include "GeometryPool.h"
+
+// Число квадратиков в стае.
+#define SWARM_SIZE 500u
 
 class Game : public Application
 {
@@ -19,106 +23,132 @@ class Game : public Application
         engineParameters_[EP_FULL_SCREEN] = false;
         engineParameters_[EP_WINDOW_WIDTH] = 800;
         engineParameters_[EP_WINDOW_HEIGHT] = 600;
-        engineParameters_[EP_RESOURCE_PATHS] = "Step2Data;Data;CoreData";
+        SetResourceDirs("Step2Data;Data;CoreData");
+    }
+
+    // Каталог ресурсов можно упаковать утилитой PackageTool в файл с тем же именем и расширением .pak
+    // (Data.pak вместо Data). Из одного открытого файла пакета ресурсы читаются быстрее, чем множество
+    // отдельных файлов при холодном старте. Если пакет найден, каталог с тем же именем не используется вовсе,
+    // так что после правки ресурсов пакет нужно пересобрать или удалить. Кроме того, ResourceCache по
+    // умолчанию ищет ресурсы сначала в пакетах, потом в каталогах (SetSearchPackagesFirst()).
+    void SetResourceDirs(const String& dirs)
+    {
+        FileSystem* fileSystem = GetSubsystem<FileSystem>();
+
+        // Пакеты ищутся там же, где их ищет Engine: в каталогах EP_RESOURCE_PREFIX_PATHS (если параметр задан
+        // в Setup() или в командной строке) или рядом с программой. Относительные пути отсчитываются от нее.
+        String prefixParameter = engineParameters_.Contains(EP_RESOURCE_PREFIX_PATHS) ?
+            engineParameters_[EP_RESOURCE_PREFIX_PATHS].GetString() : String::EMPTY;
+        Vector<String> prefixes = prefixParameter.Split(';', true);
+        for (unsigned i = 0; i < prefixes.Size(); i++)
+        {
+            prefixes[i] = AddTrailingSlash(IsAbsolutePath(prefixes[i]) ? prefixes[i] :
+                fileSystem->GetProgramDir() + prefixes[i]);
+        }
+
+        Vector<String> paths;
+        Vector<String> packages;
+
+        Vector<String> names = dirs.Split(';');
+        for (unsigned i = 0; i < names.Size(); i++)
+        {
+            bool packed = false;
+            for (unsigned j = 0; j < prefixes.Size() && !packed; j++)
+                packed = fileSystem->FileExists(prefixes[j] + names[i] + ".pak");
+
+            if (packed)
+                packages.Push(names[i] + ".pak");
+            else
+                paths.Push(names[i]);
+        }
+
+        engineParameters_[EP_RESOURCE_PATHS] = String::Joined(paths, ";");
+        engineParameters_[EP_RESOURCE_PACKAGES] = String::Joined(packages, ";");
     }
 
-    // Общий вершинный буфер для обеих геометрических фигур.
-    SharedPtr<VertexBuffer> vertexBuffer_;
+    // Возможности убершейдера. Каждому флагу соответствует define в MyUberShader.
+    enum UberFlags
+    {
+        UBER_VERTEXCOLOR = 1 << 0, // Учитывать цвет вершин.
+        UBER_DIFFMAP = 1 << 1,     // Накладывать текстуру.
+        UBER_SKINNED = 1 << 2,     // Брать матрицу модели из массива по индексу, записанному в вершины.
+        MAX_UBER_PERMUTATIONS = 1 << 3
+    };
+
+    // Пара вершинного и пиксельного шейдера для одной комбинации флагов.
+    struct UberPermutation
+    {
+        ShaderVariation* vs_;
+        ShaderVariation* ps_;
+    };
+
+    // Все вариации убершейдера, индекс в массиве - комбинация флагов UberFlags.
+    // Шейдеры ищутся по строке с define-ами и компилируются только один раз в Start(),
+    // а при рендеринге вариация выбирается по индексу без поиска и без задержек на компиляцию.
+    UberPermutation permutations_[MAX_UBER_PERMUTATIONS];
+
+    // Формат вершин фигур: MASK_POSITION | MASK_COLOR | MASK_TEXCOORD1. Поля идут в том же порядке,
+    // что и элементы вершины в буфере, поэтому не нужно вручную считать смещения внутри вершины.
+    struct Vertex
+    {
+        Vector3 position_;
+        unsigned color_;
+        Vector2 uv_; // u - горизонтальная текстурная координата (обычно в диапазоне 0.0 - 1.0), v - вертикальная.
+    };
+
+    // Общие буферы для всех фигур.
+    SharedPtr<GeometryPool> geometryPool_;
 
-    // Индексные буферы для треугольника и прямоугольника.
-    SharedPtr<IndexBuffer> triangleIndexBuffer_;
-    SharedPtr<IndexBuffer> rectangleIndexBuffer_;
+    // Участки пула, которые занимают треугольник и прямоугольник.
+    GPRange triangle_;
+    GPRange rectangle_;
+
+    // Вершина стаи. Кроме обычных атрибутов хранит номер матрицы модели (как номер кости при скиннинге).
+    // Элементы MASK_BLENDWEIGHTS и MASK_BLENDINDICES идут в вершине после MASK_TEXCOORD1.
+    struct SwarmVertex
+    {
+        Vector3 position_;
+        unsigned color_;
+        Vector2 uv_;
+        Vector4 blendWeights_;         // Вес единственной "кости" всегда равен 1.
+        unsigned char blendIndices_[4]; // Номер матрицы в массиве.
+    };
+
+    // Стая одинаковых движущихся квадратиков. Без массива матриц каждому квадратику нужны своя матрица модели
+    // и свой драв колл. Здесь геометрия содержит сразу swarmBatchSize_ копий квадрата, каждая со своим
+    // номером матрицы, и за один драв колл выводится столько квадратиков, сколько матриц помещается в массив
+    // VSP_SKINMATRICES (Graphics::GetMaxBones()).
+    SharedPtr<GeometryPool> swarmPool_;
+    GPRange swarm_;
+    unsigned swarmBatchSize_;
+
+    // Матрицы моделей квадратиков. Хранятся в классе, чтобы не выделять память каждый кадр.
+    PODVector<Matrix3x4> swarmMatrices_;
+
+    // Текстура фигур. Загружается в Start(), а не при первом кадре.
+    SharedPtr<Texture2D> texture_;
 
     void Start()
     {
-        vertexBuffer_ = new VertexBuffer(context_);
-        vertexBuffer_->SetShadowed(true);
-  
-        // Три вершины треугольника и четыре вершины прямоугольника.
-        vertexBuffer_->SetSize(3 + 4, MASK_POSITION | MASK_COLOR | MASK_TEXCOORD1);
-
-        float* vertexData = (float*)vertexBuffer_->Lock(0, vertexBuffer_->GetVertexCount());
-        int i = 0;
-
-        // Первая вершина треугольника (слева вверху).
-        vertexData[i++] = -0.5f; // x
-        vertexData[i++] = 0.5f;  // y
-        vertexData[i++] = 0.0f;  // z
-        ((unsigned&)vertexData[i++]) = Color::RED.ToUInt(); // цвет
-        vertexData[i++] = 0.0f; // u (горизонтальная текстурная координата, обычно находится в диапазоне 0.0 - 1.0)
-        vertexData[i++] = 0.0f; // v (вертикальная текстурная координата)
-
-        // Вторая вершина треугольника (выше центра экрана).
-        vertexData[i++] = 0.0f; // x
-        vertexData[i++] = 0.5f; // y
-        vertexData[i++] = 0.0f; // z
-        ((unsigned&)vertexData[i++]) = Color::GREEN.ToUInt(); // цвет
-        vertexData[i++] = 1.0f; // u
-        vertexData[i++] = 0.0f; // v
-
-        // Третья вершина треугольника (в центре экрана).
-        vertexData[i++] = 0.0f; // x
-        vertexData[i++] = 0.0f; // y
-        vertexData[i++] = 0.0f; // z
-        ((unsigned&)vertexData[i++]) = Color::BLUE.ToUInt(); // цвет
-        vertexData[i++] = 1.0f; // u
-        vertexData[i++] = 1.0f; // v
-
-        // Первая вершина прямоугольника (слева вверху).
-        vertexData[i++] = -0.25f; // x
-        vertexData[i++] = 0.25f;  // y
-        vertexData[i++] = 0.0f;   // z
-        ((unsigned&)vertexData[i++]) = Color::MAGENTA.ToUInt(); // цвет
-        vertexData[i++] = 0.0f; // u
-        vertexData[i++] = 0.0f; // v
-
-        // Вторая вершина прямоугольника (справа вверху).
-        vertexData[i++] = 0.25f; // x
-        vertexData[i++] = 0.25f; // y
-        vertexData[i++] = 0.0f;  // z
-        ((unsigned&)vertexData[i++]) = Color::MAGENTA.ToUInt(); // цвет
-        vertexData[i++] = 1.0f; // u
-        vertexData[i++] = 0.0f; // v
-
-        // Третья вершина прямоугольника (справа внизу).
-        vertexData[i++] = 0.25f;  // x
-        vertexData[i++] = -0.25f; // y
-        vertexData[i++] = 0.0f;   // z
-        ((unsigned&)vertexData[i++]) = Color::MAGENTA.ToUInt(); // цвет
-        vertexData[i++] = 1.0f; // u
-        vertexData[i++] = 1.0f; // v
-
-        // Четвертая вершина прямоугольника (слева внизу).
-        vertexData[i++] = -0.25f; // x
-        vertexData[i++] = -0.25f; // y
-        vertexData[i++] = 0.0f;   // z
-        ((unsigned&)vertexData[i++]) = Color::MAGENTA.ToUInt(); // цвет
-        vertexData[i++] = 0.0f; // u
-        vertexData[i++] = 1.0f; // v
-
-        vertexBuffer_->Unlock();
-
-        // Индексный буфер для треугольника.
-        triangleIndexBuffer_ = new IndexBuffer(context_);
-        triangleIndexBuffer_->SetShadowed(true);
-        triangleIndexBuffer_->SetSize(3, false); // Используем 16-ти битные индексы.
-
-        unsigned short* triangleIndexData =
-            (unsigned short*)triangleIndexBuffer_->Lock(0, triangleIndexBuffer_->GetIndexCount());
-
-        triangleIndexData[0] = 0;
-        triangleIndexData[1] = 1;
-        triangleIndexData[2] = 2;
-
-        triangleIndexBuffer_->Unlock();
-
-        // Индексный буфер для квадрата.
-        rectangleIndexBuffer_ = new IndexBuffer(context_);
-        rectangleIndexBuffer_->SetShadowed(true);
-        rectangleIndexBuffer_->SetSize(6, false); // Квадрат состоит из 2-х треугольников (6 вершин).
-
-        unsigned short* rectangleIndexData =
-            (unsigned short*)rectangleIndexBuffer_->Lock(0, rectangleIndexBuffer_->GetIndexCount());
+        // Места хватит и для гораздо большего числа фигур.
+        geometryPool_ = new GeometryPool(context_, 1024, 4096, MASK_POSITION | MASK_COLOR | MASK_TEXCOORD1);
+
+        Vertex triangleVertices[] =
+        {
+            { Vector3(-0.5f, 0.5f, 0.0f), Color::RED.ToUInt(),   Vector2(0.0f, 0.0f) }, // Слева вверху.
+            { Vector3(0.0f, 0.5f, 0.0f),  Color::GREEN.ToUInt(), Vector2(1.0f, 0.0f) }, // Выше центра экрана.
+            { Vector3(0.0f, 0.0f, 0.0f),  Color::BLUE.ToUInt(),  Vector2(1.0f, 1.0f) }  // В центре экрана.
+        };
+        unsigned triangleIndices[] = { 0, 1, 2 };
+        triangle_ = geometryPool_->Add(triangleVertices, 3, triangleIndices, 3);
+
+        Vertex rectangleVertices[] =
+        {
+            { Vector3(-0.25f, 0.25f, 0.0f),  Color::MAGENTA.ToUInt(), Vector2(0.0f, 0.0f) }, // Слева вверху.
+            { Vector3(0.25f, 0.25f, 0.0f),   Color::MAGENTA.ToUInt(), Vector2(1.0f, 0.0f) }, // Справа вверху.
+            { Vector3(0.25f, -0.25f, 0.0f),  Color::MAGENTA.ToUInt(), Vector2(1.0f, 1.0f) }, // Справа внизу.
+            { Vector3(-0.25f, -0.25f, 0.0f), Color::MAGENTA.ToUInt(), Vector2(0.0f, 1.0f) }  // Слева внизу.
+        };
 
         // Квадрат состоит из двух треугольников:
         // 0 ____ 1
@@ -127,61 +157,157 @@ class Game : public Application
         //  |  \ |
         //  |___\|
         // 3      2
-        // Первые три вершины в вершинном буфере не относятся к квадрату, поэтому везде прибавляется 3.
-        rectangleIndexData[0] = 3 + 0;
-        rectangleIndexData[1] = 3 + 1;
-        rectangleIndexData[2] = 3 + 2;
+        // Индексы задаются относительно первой вершины фигуры, сдвиг на начало ее участка в общем буфере
+        // пул делает сам.
+        unsigned rectangleIndices[] = { 0, 1, 2, 2, 3, 0 };
+        rectangle_ = geometryPool_->Add(rectangleVertices, 4, rectangleIndices, 6);
 
-        rectangleIndexData[3] = 3 + 2;
-        rectangleIndexData[4] = 3 + 3;
-        rectangleIndexData[5] = 3 + 0;
+        texture_ = GetSubsystem<ResourceCache>()->GetResource<Texture2D>("Textures/UrhoIcon.png");
 
-        rectangleIndexBuffer_->Unlock();
+        CreateSwarm();
+
+        CreatePermutations();
     }
 
-    void HandleEndAllViewsRender(StringHash eventType, VariantMap& eventData)
+    // Создает геометрию стаи: swarmBatchSize_ одинаковых квадратиков, которые отличаются только номером матрицы.
+    void CreateSwarm()
+    {
+        swarmBatchSize_ = Min(SWARM_SIZE, Graphics::GetMaxBones());
+
+        swarmPool_ = new GeometryPool(context_, swarmBatchSize_ * 4, swarmBatchSize_ * 6,
+            MASK_POSITION | MASK_COLOR | MASK_TEXCOORD1 | MASK_BLENDWEIGHTS | MASK_BLENDINDICES);
+
+        PODVector<SwarmVertex> vertices(swarmBatchSize_ * 4);
+        PODVector<unsigned> indices(swarmBatchSize_ * 6);
+
+        // Углы квадратика размером 0.04 и его текстурные координаты.
+        const Vector3 corners[4] =
+        {
+            Vector3(-0.02f, 0.02f, 0.0f), Vector3(0.02f, 0.02f, 0.0f), Vector3(0.02f, -0.02f, 0.0f), Vector3(-0.02f, -0.02f, 0.0f)
+        };
+        const Vector2 uvs[4] = { Vector2(0.0f, 0.0f), Vector2(1.0f, 0.0f), Vector2(1.0f, 1.0f), Vector2(0.0f, 1.0f) };
+        const unsigned quadIndices[6] = { 0, 1, 2, 2, 3, 0 };
+
+        for (unsigned i = 0; i < swarmBatchSize_; i++)
+        {
+            // Цвета меняются вдоль стаи.
+            unsigned color = Color(i / (float)swarmBatchSize_, 1.0f, 1.0f - i / (float)swarmBatchSize_).ToUInt();
+
+            for (unsigned j = 0; j < 4; j++)
+            {
+                SwarmVertex& vertex = vertices[i * 4 + j];
+                vertex.position_ = corners[j];
+                vertex.color_ = color;
+                vertex.uv_ = uvs[j];
+                vertex.blendWeights_ = Vector4(1.0f, 0.0f, 0.0f, 0.0f);
+                vertex.blendIndices_[0] = (unsigned char)i;
+                vertex.blendIndices_[1] = vertex.blendIndices_[2] = vertex.blendIndices_[3] = 0;
+            }
+
+            for (unsigned j = 0; j < 6; j++)
+                indices[i * 6 + j] = i * 4 + quadIndices[j];
+        }
+
+        swarm_ = swarmPool_->Add(vertices.Buffer(), vertices.Size(), indices.Buffer(), indices.Size());
+        swarmMatrices_.Resize(SWARM_SIZE);
+    }
+
+    // Выводит стаю. Вместо SWARM_SIZE загрузок VSP_MODEL и драв коллов нужно SWARM_SIZE / swarmBatchSize_
+    // загрузок массива матриц и столько же драв коллов.
+    void RenderSwarm(float time, const Vector3& aspectScale)
     {
         Graphics* graphics = GetSubsystem<Graphics>();
-        ResourceCache* cache = GetSubsystem<ResourceCache>();
 
-        // Получаем различные вариации убершейдера.
+        // Квадратики движутся по фигуре Лиссажу, каждый со своим сдвигом по фазе, и вращаются.
+        for (unsigned i = 0; i < SWARM_SIZE; i++)
+        {
+            float phase = time * 20.0f + i * 360.0f / SWARM_SIZE;
+            Vector3 position(Sin(phase * 3.0f) * 0.9f * aspectScale.x_, Sin(phase * 2.0f) * 0.9f, 0.0f);
+            swarmMatrices_[i] = Matrix3x4(position, Quaternion(phase * 4.0f), aspectScale);
+        }
 
-        // Шейдер закрашивает геометрию белым цветом (в данном примере не используется).
-        ShaderVariation* vs = graphics->GetShader(VS, "MyUberShader");
-        ShaderVariation* ps = graphics->GetShader(PS, "MyUberShader");
+        swarmPool_->Bind();
+        SetPermutation(UBER_DIFFMAP | UBER_VERTEXCOLOR | UBER_SKINNED);
+        graphics->SetShaderParameter(VSP_VIEWPROJ, Matrix4::IDENTITY);
+
+        for (unsigned start = 0; start < SWARM_SIZE; start += swarmBatchSize_)
+        {
+            unsigned count = Min(swarmBatchSize_, SWARM_SIZE - start);
 
-        // Шейдер учитывает цвет вершин.
-        ShaderVariation* vsVCol = graphics->GetShader(VS, "MyUberShader", "VERTEXCOLOR");
-        ShaderVariation* psVCol = graphics->GetShader(PS, "MyUberShader", "VERTEXCOLOR");
+            // Каждая матрица 3x4 занимает 12 чисел.
+            graphics->SetShaderParameter(VSP_SKINMATRICES, swarmMatrices_[start].Data(), count * 12);
+
+            // Выводятся только первые count квадратиков геометрии стаи.
+            GPRange range = swarm_;
+            range.vertexCount_ = count * 4;
+            range.indexCount_ = count * 6;
+            swarmPool_->Draw(range);
+        }
+    }
+
+    // Получает все вариации убершейдера и сразу компилирует их.
+    void CreatePermutations()
+    {
+        Graphics* graphics = GetSubsystem<Graphics>();
 
-        // Шейдер накладывает текстуру.
-        ShaderVariation* vsDiff = graphics->GetShader(VS, "MyUberShader", "DIFFMAP");
-        ShaderVariation* psDiff = graphics->GetShader(PS, "MyUberShader", "DIFFMAP");
+        for (unsigned flags = 0; flags < MAX_UBER_PERMUTATIONS; flags++)
+        {
+            String defines;
+            if (flags & UBER_DIFFMAP)
+                defines += "DIFFMAP ";
+            if (flags & UBER_VERTEXCOLOR)
+                defines += "VERTEXCOLOR ";
+            if (flags & UBER_SKINNED)
+                defines += "SKINNED ";
+            defines = defines.Trimmed();
+
+            permutations_[flags].vs_ = graphics->GetShader(VS, "MyUberShader", defines);
+            permutations_[flags].ps_ = graphics->GetShader(PS, "MyUberShader", defines);
+        }
+
+        // GetShader() только загружает исходный код шейдера. Компиляция вариации (и линковка программы в OpenGL)
+        // происходит при первой установке шейдеров, поэтому устанавливаем каждую пару заранее.
+        for (unsigned flags = 0; flags < MAX_UBER_PERMUTATIONS; flags++)
+        {
+            const UberPermutation& permutation = permutations_[flags];
+            graphics->SetShaders(permutation.vs_, permutation.ps_);
+
+            if (!permutation.vs_ || !permutation.vs_->GetGPUObject() || !permutation.ps_ || !permutation.ps_->GetGPUObject())
+                URHO3D_LOGERROR("Failed to compile MyUberShader permutation " + String(flags));
+        }
+
+        graphics->SetShaders(nullptr, nullptr);
+    }
 
-        // Шейдер накладывает текстуру и учитывает цвет вершин.
-        ShaderVariation* vsDiffVCol = graphics->GetShader(VS, "MyUberShader", "DIFFMAP VERTEXCOLOR");
-        ShaderVariation* psDiffVCol = graphics->GetShader(PS, "MyUberShader", "DIFFMAP VERTEXCOLOR");
+    // Устанавливает вариацию убершейдера с указанными флагами UberFlags.
+    void SetPermutation(unsigned flags)
+    {
+        const UberPermutation& permutation = permutations_[flags];
+        GetSubsystem<Graphics>()->SetShaders(permutation.vs_, permutation.ps_);
+    }
 
+    void HandleEndAllViewsRender(StringHash eventType, VariantMap& eventData)
+    {
+        Graphics* graphics = GetSubsystem<Graphics>();
         // Буфер глубины не используется, фигуры накладываются в порядке отрисовки.
         graphics->SetDepthTest(CMP_ALWAYS);
         graphics->SetDepthWrite(false);
 
-        graphics->SetVertexBuffer(vertexBuffer_);
-        graphics->SetTexture(TU_DIFFUSE, cache->GetResource<Texture2D>("Textures/UrhoIcon.png"));
+        // Буферы общие для всех фигур и устанавливаются один раз.
+        geometryPool_->Bind();
+        graphics->SetTexture(TU_DIFFUSE, texture_);
 
         // Рисуем затекстуренный квадрат (который выглядит как прямоугольник).
-        graphics->SetIndexBuffer(rectangleIndexBuffer_);
-        graphics->SetShaders(vsDiff, psDiff);
+        SetPermutation(UBER_DIFFMAP);
         graphics->SetShaderParameter(VSP_MODEL, Matrix3x4::IDENTITY);
         graphics->SetShaderParameter(VSP_VIEWPROJ, Matrix4::IDENTITY);
-        graphics->Draw(TRIANGLE_LIST, 0, 6, 3, 4);
+        geometryPool_->Draw(rectangle_);
 
         // Рисуем градиентный треугольник.
-        graphics->SetIndexBuffer(triangleIndexBuffer_);
-        graphics->SetShaders(vsVCol, psVCol);
+        SetPermutation(UBER_VERTEXCOLOR);
         graphics->SetShaderParameter(VSP_MODEL, Matrix3x4::IDENTITY);
         graphics->SetShaderParameter(VSP_VIEWPROJ, Matrix4::IDENTITY);
-        graphics->Draw(TRIANGLE_LIST, 0, 3, 0, 3);
+        geometryPool_->Draw(triangle_);
 
         // Меняем координаты движущегося квадрата по гармоническому закону в зависимости от времени.
         float time = GetSubsystem<Time>()->GetElapsedTime(); // Время с запуска программы.
@@ -193,11 +319,13 @@ class Game : public Application
         Vector3 rectScale = Vector3(graphics->GetHeight() / (float)graphics->GetWidth(), 1.0f, 1.0f);
 
         // Рисуем движущийся квадрат.
-        graphics->SetIndexBuffer(rectangleIndexBuffer_);
-        graphics->SetShaders(vsDiffVCol, psDiffVCol);
+        SetPermutation(UBER_DIFFMAP | UBER_VERTEXCOLOR);
         graphics->SetShaderParameter(VSP_MODEL, Matrix3x4(rectanglePos, Quaternion::IDENTITY, rectScale));
         graphics->SetShaderParameter(VSP_VIEWPROJ, Matrix4::IDENTITY);
-        graphics->Draw(TRIANGLE_LIST, 0, 6, 3, 4);
+        geometryPool_->Draw(rectangle_);
+
+        // Рисуем стаю квадратиков.
+        RenderSwarm(time, rectScale);
     }
 };
 
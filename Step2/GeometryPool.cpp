@@ -0,0 +1,92 @@
+﻿#include "GeometryPool.h"
+
+GeometryPool::GeometryPool(Context* context, unsigned maxVertices, unsigned maxIndices, unsigned elementMask) :
+    Object(context),
+    numVertices_(0),
+    numIndices_(0)
+{
+    // Теневые копии в памяти процессора позволяют дописывать фигуры по частям
+    // и восстанавливать содержимое буферов при потере устройства.
+    vertexBuffer_ = new VertexBuffer(context_);
+    vertexBuffer_->SetShadowed(true);
+    vertexBuffer_->SetSize(maxVertices, elementMask);
+
+    indexBuffer_ = new IndexBuffer(context_);
+    indexBuffer_->SetShadowed(true);
+    indexBuffer_->SetSize(maxIndices, maxVertices > 65536);
+}
+
+GeometryPool::~GeometryPool()
+{
+}
+
+GPRange GeometryPool::Add(const void* vertices, unsigned vertexCount, const unsigned* indices, unsigned indexCount)
+{
+    GPRange range { numVertices_, 0, numIndices_, 0 };
+
+    if (numVertices_ + vertexCount > vertexBuffer_->GetVertexCount() ||
+        numIndices_ + indexCount > indexBuffer_->GetIndexCount())
+    {
+        URHO3D_LOGERROR("GeometryPool: not enough space for the shape");
+        return range;
+    }
+
+    // Индекс за пределами фигуры указывал бы на вершины другой фигуры или на неиспользуемую часть буфера.
+    for (unsigned i = 0; i < indexCount; i++)
+    {
+        if (indices[i] >= vertexCount)
+        {
+            URHO3D_LOGERROR("GeometryPool: shape index " + String(indices[i]) + " is out of range");
+            return range;
+        }
+    }
+
+    vertexBuffer_->SetDataRange(vertices, numVertices_, vertexCount);
+
+    // Индексы фигуры сдвигаются так, чтобы указывать на ее участок вершинного буфера.
+    unsigned indexSize = indexBuffer_->GetIndexSize();
+    indexData_.Resize(indexCount * indexSize);
+
+    if (indexSize == sizeof(unsigned))
+    {
+        unsigned* dest = (unsigned*)indexData_.Buffer();
+        for (unsigned i = 0; i < indexCount; i++)
+            dest[i] = numVertices_ + indices[i];
+    }
+    else
+    {
+        unsigned short* dest = (unsigned short*)indexData_.Buffer();
+        for (unsigned i = 0; i < indexCount; i++)
+            dest[i] = (unsigned short)(numVertices_ + indices[i]);
+    }
+
+    indexBuffer_->SetDataRange(indexData_.Buffer(), numIndices_, indexCount);
+
+    range.vertexCount_ = vertexCount;
+    range.indexCount_ = indexCount;
+    numVertices_ += vertexCount;
+    numIndices_ += indexCount;
+
+    return range;
+}
+
+void GeometryPool::Clear()
+{
+    numVertices_ = 0;
+    numIndices_ = 0;
+}
+
+void GeometryPool::Bind()
+{
+    Graphics* graphics = GetSubsystem<Graphics>();
+    graphics->SetVertexBuffer(vertexBuffer_);
+    graphics->SetIndexBuffer(indexBuffer_);
+}
+
+void GeometryPool::Draw(const GPRange& range, PrimitiveType type/* = TRIANGLE_LIST*/)
+{
+    if (!range.indexCount_)
+        return;
+
+    GetSubsystem<Graphics>()->Draw(type, range.indexStart_, range.indexCount_, range.vertexStart_, range.vertexCount_);
+}
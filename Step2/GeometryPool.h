@@ -0,0 +1,62 @@
+﻿/*
+    Общий пул геометрии для статических фигур. Вместо отдельных буферов для каждой фигуры все фигуры
+    размещаются в одном большом вершинном и одном индексном буфере. Каждая фигура занимает свой участок
+    (диапазон вершин и индексов), и все фигуры выводятся после одной установки буферов.
+*/
+
+#pragma once
+
+#include <Urho3D/Urho3DAll.h>
+
+// Участок пула, который занимает одна фигура.
+struct GPRange
+{
+    unsigned vertexStart_;
+    unsigned vertexCount_;
+    unsigned indexStart_;
+    unsigned indexCount_;
+};
+
+class GeometryPool : public Object
+{
+    URHO3D_OBJECT(GeometryPool, Object);
+
+public:
+    // Размеры пула задаются сразу и не меняются. Формат вершин общий для всех фигур. Если maxVertices
+    // больше 65536, то используются 32-битные индексы.
+    GeometryPool(Context* context, unsigned maxVertices, unsigned maxIndices, unsigned elementMask);
+    virtual ~GeometryPool();
+
+    // Копирует фигуру в пул и возвращает занятый ей участок. Индексы задаются относительно первой вершины
+    // фигуры (0 - первая вершина из vertices), в пуле они сдвигаются на начало участка.
+    // Если фигура не помещается, возвращается пустой участок (с нулевыми размерами).
+    GPRange Add(const void* vertices, unsigned vertexCount, const unsigned* indices, unsigned indexCount);
+
+    // Освобождает пул целиком. Участки, выданные до этого, становятся недействительными.
+    void Clear();
+
+    // Устанавливает буферы пула. Достаточно одного вызова перед выводом всех фигур.
+    void Bind();
+
+    // Рисует фигуру. Буферы пула должны быть установлены.
+    void Draw(const GPRange& range, PrimitiveType type = TRIANGLE_LIST);
+
+    VertexBuffer* GetVertexBuffer() const { return vertexBuffer_; }
+    IndexBuffer* GetIndexBuffer() const { return indexBuffer_; }
+
+    // Сколько вершин и индексов уже занято.
+    unsigned GetNumVertices() const { return numVertices_; }
+    unsigned GetNumIndices() const { return numIndices_; }
+
+private:
+    // Буферы не динамические: они заполняются при загрузке и потом только используются.
+    SharedPtr<VertexBuffer> vertexBuffer_;
+    SharedPtr<IndexBuffer> indexBuffer_;
+
+    // Начало свободной части буферов. Участки выделяются подряд и по отдельности не освобождаются.
+    unsigned numVertices_;
+    unsigned numIndices_;
+
+    // Временный массив для сдвинутых индексов. Хранится в классе, чтобы не выделять память для каждой фигуры.
+    PODVector<unsigned char> indexData_;
+};
@@ -5,6 +5,10 @@
 #line 5
 
 void VS(float4 iPos : POSITION,
+    #ifdef SKINNED
+        float4 iBlendWeights : BLENDWEIGHT,
+        int4 iBlendIndices : BLENDINDICES,
+    #endif
     #ifdef VERTEXCOLOR
         float4 iColor : COLOR0,
         out float4 oColor : COLOR0,
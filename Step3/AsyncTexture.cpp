@@ -0,0 +1,42 @@
+﻿#include "AsyncTexture.h"
+
+AsyncTexture::AsyncTexture(Context* context, const String& name) : Object(context),
+    failed_(false)
+{
+    ResourceCache* cache = GetSubsystem<ResourceCache>();
+    name_ = cache->SanitateResourceName(name);
+
+    texture_ = cache->GetExistingResource<Texture2D>(name_);
+    if (texture_)
+        return;
+
+    SubscribeToEvent(E_RESOURCEBACKGROUNDLOADED, URHO3D_HANDLER(AsyncTexture, HandleResourceBackgroundLoaded));
+
+    // Возвращает false, если такая загрузка уже идет (например, ее начал другой AsyncTexture).
+    // Событие о ее завершении все равно придет.
+    cache->BackgroundLoadResource<Texture2D>(name_);
+
+    // Если движок собран без поддержки потоков, текстура загружается сразу и события не будет.
+    texture_ = cache->GetExistingResource<Texture2D>(name_);
+    if (texture_)
+        UnsubscribeFromEvent(E_RESOURCEBACKGROUNDLOADED);
+}
+
+AsyncTexture::~AsyncTexture()
+{
+}
+
+void AsyncTexture::HandleResourceBackgroundLoaded(StringHash eventType, VariantMap& eventData)
+{
+    using namespace ResourceBackgroundLoaded;
+
+    if (eventData[P_RESOURCENAME].GetString() != name_)
+        return;
+
+    if (eventData[P_SUCCESS].GetBool())
+        texture_ = static_cast<Texture2D*>(eventData[P_RESOURCE].GetPtr());
+    else
+        failed_ = true;
+
+    UnsubscribeFromEvent(E_RESOURCEBACKGROUNDLOADED);
+}
@@ -0,0 +1,39 @@
+﻿/*
+    Текстура, которая загружается в фоновом потоке (ResourceCache::BackgroundLoadResource()). Создается один раз
+    (например, в Start()), и при выводе спрайтов не нужно каждый кадр искать текстуру в кэше ресурсов по имени.
+    Пока текстура не загружена, SpriteBatch::Draw() пропускает такие спрайты или выводит вместо них заглушку
+    (SpriteBatch::SetPlaceholderTexture()), так что загрузка новых текстур не останавливает кадры.
+*/
+
+#pragma once
+
+#include <Urho3D/Urho3DAll.h>
+
+class AsyncTexture : public Object
+{
+    URHO3D_OBJECT(AsyncTexture, Object);
+
+public:
+    // Если текстура уже есть в кэше, она используется сразу, иначе начинается фоновая загрузка.
+    AsyncTexture(Context* context, const String& name);
+    virtual ~AsyncTexture();
+
+    // nullptr, пока текстура не загружена.
+    Texture2D* Get() const { return texture_; }
+    bool IsLoaded() const { return texture_ != nullptr; }
+
+    // Загрузка завершилась ошибкой, текстура так и не появится.
+    bool IsFailed() const { return failed_; }
+
+    const String& GetName() const { return name_; }
+
+private:
+    // Имя в том виде, в котором его хранит кэш ресурсов (и передает в событии).
+    String name_;
+
+    SharedPtr<Texture2D> texture_;
+    bool failed_;
+
+    // Фоновые загрузки завершаются в основном потоке (в начале кадра), после чего кэш посылает это событие.
+    void HandleResourceBackgroundLoaded(StringHash eventType, VariantMap& eventData);
+};
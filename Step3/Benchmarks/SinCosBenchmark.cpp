@@ -0,0 +1,84 @@
+﻿/*
+    Сравнение точного вычисления синуса и косинуса (SinCos() из Urho3D) с табличным (SpriteBatch::TableSinCos()).
+    Собирается как консольная программа вместе с ../SpriteBatch.cpp
+    (и ../SpriteLayer.cpp, ../SpriteEmitter.cpp, которые нужны SpriteBatch). Результаты выводятся в стандартный вывод.
+*/
+
+#include <Urho3D/Urho3DAll.h>
+#include <cstdio>
+
+#include "../SpriteBatch.h"
+
+// Число вычислений в каждом замере.
+#define NUM_ANGLES (1024 * 1024)
+
+// Число повторов. Берется лучший результат, чтобы уменьшить влияние других процессов.
+#define NUM_RUNS 10
+
+// Углы, для которых вычисляются синусы и косинусы. Как и у спрайтов, они не упорядочены.
+static PODVector<float> CreateAngles()
+{
+    PODVector<float> angles(NUM_ANGLES);
+    SetRandomSeed(1);
+    for (unsigned i = 0; i < NUM_ANGLES; i++)
+        angles[i] = Random(-720.0f, 720.0f);
+    return angles;
+}
+
+// Возвращает лучшее время в микросекундах. Сумма результатов нужна, чтобы компилятор не выбросил вычисления.
+template <class F> static long long Measure(const PODVector<float>& angles, F sinCos, float& checksum)
+{
+    long long bestTime = M_MAX_INT;
+
+    for (unsigned run = 0; run < NUM_RUNS; run++)
+    {
+        HiresTimer timer;
+        float sum = 0.0f;
+
+        for (unsigned i = 0; i < angles.Size(); i++)
+        {
+            float sin, cos;
+            sinCos(angles[i], sin, cos);
+            sum += sin + cos;
+        }
+
+        bestTime = Min(bestTime, timer.GetUSec(false));
+        checksum = sum;
+    }
+
+    return bestTime;
+}
+
+int main()
+{
+    // Частота HiresTimer определяется при создании подсистемы Time.
+    SharedPtr<Context> context(new Context());
+    context->RegisterSubsystem(new Time(context));
+
+    PODVector<float> angles = CreateAngles();
+    float exactChecksum, tableChecksum;
+
+    long long exactTime = Measure(angles, [](float angle, float& sin, float& cos) { SinCos(angle, sin, cos); },
+                                  exactChecksum);
+    long long tableTime = Measure(angles, SpriteBatch::TableSinCos, tableChecksum);
+
+    // Наибольшая ошибка таблицы.
+    float maxError = 0.0f;
+    for (unsigned i = 0; i < angles.Size(); i++)
+    {
+        float exactSin, exactCos, tableSin, tableCos;
+        SinCos(angles[i], exactSin, exactCos);
+        SpriteBatch::TableSinCos(angles[i], tableSin, tableCos);
+        maxError = Max(maxError, Max(Abs(exactSin - tableSin), Abs(exactCos - tableCos)));
+    }
+
+    printf("Angles: %u, table size: %u\n", NUM_ANGLES, SB_ROTATION_TABLE_SIZE);
+    printf("SinCos():                   %lld us (checksum %f)\n", exactTime, exactChecksum);
+    printf("SpriteBatch::TableSinCos(): %lld us (checksum %f)\n", tableTime, tableChecksum);
+    printf("Speedup: %.2fx\n", (double)exactTime / Max(tableTime, 1LL));
+
+    // Для спрайта размером 256 пикселей ошибка положения угла примерно равна 256 * maxError пикселей.
+    printf("Max error: %f (%f px for a 256 px sprite)\n", maxError, maxError * 256.0f);
+
+    return 0;
+}
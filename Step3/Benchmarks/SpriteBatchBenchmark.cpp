@@ -0,0 +1,325 @@
+﻿/*
+    Замер производительности SpriteBatch. Собирается так же, как Game.cpp (вместо него), вместе с ../SpriteBatch.cpp,
+    ../SpriteLayer.cpp, ../SpriteAnimation.cpp и ../SpriteEmitter.cpp. Сценарий задается в командной строке:
+
+    -sprites N      число спрайтов (по умолчанию 100000)
+    -rotated R      доля повернутых спрайтов от 0 до 1 (по умолчанию 0.5)
+    -scaled S       доля отмасштабированных спрайтов от 0 до 1 (по умолчанию 0.5)
+    -animated A     доля анимированных спрайтов от 0 до 1 (по умолчанию 0)
+    -textures K     число разных текстур (по умолчанию 4)
+    -pattern P      порядок текстур: grouped (подряд), interleaved (по очереди) или random (по умолчанию interleaved)
+    -sort M         deferred, texture, backtofront, fronttoback, immediate или layered (по умолчанию deferred)
+    -frames F       число измеряемых кадров (по умолчанию 300)
+    -instancing     использовать инстансинг
+    -multitexture   использовать режим нескольких текстур
+    -bulk           передавать спрайты через DrawBulk(), а не по одному
+    -offscreen      рисовать в текстуру, а не на экран
+    -scissor        выводить спрайты только в верхней половине области вывода (SetScissor()). Вместе с -offscreen
+                    в OpenGL проверяет переворот области отсечения для текстуры. С -bulk не действует,
+                    так как состояние спрайтов DrawBulk() записано в самих спрайтах
+
+    Результаты выводятся в лог и в стандартный вывод, после чего программа завершается.
+    Вертикальная синхронизация и ограничение FPS отключаются. Время кадра включает работу видеокарты
+    (таймеров видеокарты в движке нет), поэтому играет роль времени GPU.
+*/
+
+#include <Urho3D/Urho3DAll.h>
+#include <cstdio>
+
+#include "../SpriteBatch.h"
+#include "../SpriteAnimation.h"
+
+// Кадры, которые пропускаются перед началом измерений (загрузка шейдеров, выделение памяти и т.п.).
+#define WARMUP_FRAMES 30
+
+// Размер генерируемых текстур.
+#define TEXTURE_SIZE 32
+
+class SpriteBatchBenchmark : public Application
+{
+    URHO3D_OBJECT(SpriteBatchBenchmark, Application);
+
+public:
+    SharedPtr<SpriteBatch> spriteBatch_;
+
+    // Параметры сценария.
+    unsigned numSprites_ = 100000;
+    float rotatedRatio_ = 0.5f;
+    float scaledRatio_ = 0.5f;
+    float animatedRatio_ = 0.0f;
+    unsigned numTextures_ = 4;
+    String pattern_ = "interleaved";
+    SortMode sortMode_ = SORT_DEFERRED;
+    unsigned numFrames_ = 300;
+    bool instancing_ = false;
+    bool multiTexture_ = false;
+    bool bulk_ = false;
+    bool offscreen_ = false;
+    bool scissor_ = false;
+
+    // Спрайты сценария. Создаются один раз, чтобы измерялась только работа SpriteBatch.
+    PODVector<SpriteBatch::SBSprite> sprites_;
+    Vector<SharedPtr<Texture2D> > textures_;
+
+    // Анимации из четырех кадров (четвертей текстуры), по одной на текстуру.
+    Vector<SharedPtr<SpriteAnimation> > animations_;
+
+    // Текстура, в которую идет рендеринг в режиме -offscreen.
+    SharedPtr<Texture2D> renderTexture_;
+
+    // Накопленные результаты.
+    unsigned frameNumber_ = 0;
+    HiresTimer totalTimer_;
+    long long endTime_ = 0;
+    unsigned long long numDrawCalls_ = 0;
+    unsigned long long numSpritesDrawn_ = 0;
+    unsigned long long bytesUploaded_ = 0;
+
+    SpriteBatchBenchmark(Context* context) : Application(context)
+    {
+    }
+
+    void Setup()
+    {
+        engineParameters_[EP_FULL_SCREEN] = false;
+        engineParameters_[EP_WINDOW_WIDTH] = 1280;
+        engineParameters_[EP_WINDOW_HEIGHT] = 720;
+        engineParameters_[EP_VSYNC] = false;
+        engineParameters_[EP_RESOURCE_PATHS] = "Step3Data;Data;CoreData";
+
+        ParseArguments();
+    }
+
+    void ParseArguments()
+    {
+        const Vector<String>& arguments = GetArguments();
+
+        for (unsigned i = 0; i < arguments.Size(); i++)
+        {
+            String argument = arguments[i].ToLower();
+            String value = i + 1 < arguments.Size() ? arguments[i + 1].ToLower() : String::EMPTY;
+
+            if (argument == "-sprites")
+                numSprites_ = ToUInt(value);
+            else if (argument == "-rotated")
+                rotatedRatio_ = ToFloat(value);
+            else if (argument == "-scaled")
+                scaledRatio_ = ToFloat(value);
+            else if (argument == "-animated")
+                animatedRatio_ = ToFloat(value);
+            else if (argument == "-textures")
+                numTextures_ = Max(ToUInt(value), 1u);
+            else if (argument == "-pattern")
+                pattern_ = value;
+            else if (argument == "-frames")
+                numFrames_ = Max(ToUInt(value), 1u);
+            else if (argument == "-sort")
+            {
+                if (value == "texture")
+                    sortMode_ = SORT_TEXTURE;
+                else if (value == "backtofront")
+                    sortMode_ = SORT_BACKTOFRONT;
+                else if (value == "fronttoback")
+                    sortMode_ = SORT_FRONTTOBACK;
+                else if (value == "immediate")
+                    sortMode_ = SORT_IMMEDIATE;
+                else if (value == "layered")
+                    sortMode_ = SORT_LAYERED;
+                else
+                    sortMode_ = SORT_DEFERRED;
+            }
+            else if (argument == "-instancing")
+                instancing_ = true;
+            else if (argument == "-multitexture")
+                multiTexture_ = true;
+            else if (argument == "-bulk")
+                bulk_ = true;
+            else if (argument == "-offscreen")
+                offscreen_ = true;
+            else if (argument == "-scissor")
+                scissor_ = true;
+        }
+    }
+
+    void Start()
+    {
+        // Без ограничения FPS.
+        engine_->SetMaxFps(0);
+
+        spriteBatch_ = new SpriteBatch(context_);
+        spriteBatch_->SetInstancing(instancing_);
+        spriteBatch_->SetMultiTexture(multiTexture_);
+
+        // Сцены нет, и глубина спрайтов не должна сравниваться с глубиной прошлого кадра.
+        spriteBatch_->SetClearDepth(true);
+        spriteBatch_->Reserve(numSprites_);
+
+        CreateTextures();
+        CreateSprites();
+
+        if (offscreen_)
+        {
+            Graphics* graphics = GetSubsystem<Graphics>();
+            renderTexture_ = new Texture2D(context_);
+            renderTexture_->SetSize(graphics->GetWidth(), graphics->GetHeight(), Graphics::GetRGBAFormat(), TEXTURE_RENDERTARGET);
+        }
+
+        SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(SpriteBatchBenchmark, HandleUpdate));
+        SubscribeToEvent(E_ENDALLVIEWSRENDER, URHO3D_HANDLER(SpriteBatchBenchmark, HandleEndAllViewsRender));
+    }
+
+    // Текстуры одного размера, различающиеся только цветом. Загружать их из файлов не нужно.
+    void CreateTextures()
+    {
+        for (unsigned i = 0; i < numTextures_; i++)
+        {
+            SharedPtr<Image> image(new Image(context_));
+            image->SetSize(TEXTURE_SIZE, TEXTURE_SIZE, 4);
+            image->Clear(Color(Random(0.5f, 1.0f), Random(0.5f, 1.0f), Random(0.5f, 1.0f)));
+
+            SharedPtr<Texture2D> texture(new Texture2D(context_));
+            texture->SetData(image);
+            textures_.Push(texture);
+
+            SharedPtr<SpriteAnimation> animation(new SpriteAnimation(texture, 10.0f));
+            animation->AddFrames(IntRect(0, 0, TEXTURE_SIZE / 2, TEXTURE_SIZE / 2), 4, 2);
+            animations_.Push(animation);
+        }
+    }
+
+    // Номер текстуры спрайта в соответствии с -pattern.
+    unsigned GetTextureIndex(unsigned spriteIndex) const
+    {
+        if (pattern_ == "grouped")
+            return spriteIndex * numTextures_ / numSprites_;
+        else if (pattern_ == "random")
+            return (unsigned)Random((int)numTextures_);
+        else
+            return spriteIndex % numTextures_;
+    }
+
+    void CreateSprites()
+    {
+        // Одинаковые сценарии должны давать одинаковые спрайты.
+        SetRandomSeed(1);
+
+        Graphics* graphics = GetSubsystem<Graphics>();
+        float width = (float)graphics->GetWidth();
+        float height = (float)graphics->GetHeight();
+
+        sprites_.Resize(numSprites_);
+
+        for (unsigned i = 0; i < numSprites_; i++)
+        {
+            SpriteBatch::SBSprite& sprite = sprites_[i];
+            sprite.texture_ = textures_[GetTextureIndex(i)];
+            sprite.sourceRect_ = IntRect(0, 0, TEXTURE_SIZE, TEXTURE_SIZE);
+            sprite.position_ = Vector2(Random(width), Random(height));
+            sprite.color_ = Color::WHITE;
+            sprite.rotation_ = Random(1.0f) < rotatedRatio_ ? Random(360.0f) : 0.0f;
+            sprite.origin_ = Vector2(TEXTURE_SIZE * 0.5f, TEXTURE_SIZE * 0.5f);
+            sprite.scale_ = Random(1.0f) < scaledRatio_ ? Random(0.5f, 1.5f) : 1.0f;
+            sprite.layerDepth_ = Random(1.0f);
+            sprite.state_ = 0;
+            sprite.transform_ = nullptr;
+            sprite.animation_ = nullptr;
+            sprite.animationStart_ = 0.0f;
+
+            // Анимированный спрайт выводит четверть текстуры, начало координат - в ее центре.
+            if (Random(1.0f) < animatedRatio_)
+            {
+                sprite.animation_ = animations_[GetTextureIndex(i) % animations_.Size()];
+                sprite.animationStart_ = Random(1.0f);
+                sprite.sourceRect_ = sprite.animation_->GetFrame(0.0f);
+                sprite.origin_ = Vector2(TEXTURE_SIZE * 0.25f, TEXTURE_SIZE * 0.25f);
+            }
+        }
+    }
+
+    void HandleUpdate(StringHash eventType, VariantMap& eventData)
+    {
+        // Статистика SpriteBatch за предыдущий кадр.
+        if (frameNumber_ > WARMUP_FRAMES)
+        {
+            const SpriteBatchStats& stats = spriteBatch_->GetStats();
+            endTime_ += stats.endTime_;
+            numDrawCalls_ += stats.numDrawCalls_;
+            numSpritesDrawn_ += stats.numSprites_;
+            bytesUploaded_ += stats.bytesUploaded_;
+        }
+
+        if (frameNumber_ == WARMUP_FRAMES)
+            totalTimer_.Reset();
+
+        if (frameNumber_ == WARMUP_FRAMES + numFrames_)
+        {
+            PrintResults();
+            engine_->Exit();
+        }
+
+        frameNumber_++;
+    }
+
+    void HandleEndAllViewsRender(StringHash eventType, VariantMap& eventData)
+    {
+        if (offscreen_)
+            spriteBatch_->Begin(sortMode_, renderTexture_);
+        else
+            spriteBatch_->Begin(sortMode_);
+
+        if (scissor_)
+        {
+            Graphics* graphics = GetSubsystem<Graphics>();
+            spriteBatch_->SetScissor(IntRect(0, 0, graphics->GetWidth(), graphics->GetHeight() / 2));
+        }
+
+        if (bulk_)
+        {
+            spriteBatch_->DrawBulk(sprites_.Buffer(), sprites_.Size());
+        }
+        else
+        {
+            for (unsigned i = 0; i < sprites_.Size(); i++)
+            {
+                const SpriteBatch::SBSprite& sprite = sprites_[i];
+                if (sprite.animation_)
+                    spriteBatch_->Draw(sprite.animation_, sprite.animationStart_, sprite.position_, sprite.color_,
+                                       sprite.rotation_, sprite.origin_, sprite.scale_, sprite.layerDepth_);
+                else
+                    spriteBatch_->Draw(sprite.texture_, sprite.sourceRect_, sprite.position_, sprite.color_,
+                                       sprite.rotation_, sprite.origin_, sprite.scale_, sprite.layerDepth_);
+            }
+        }
+
+        spriteBatch_->End();
+    }
+
+    void PrintResults()
+    {
+        double totalSeconds = totalTimer_.GetUSec(false) / 1000000.0;
+
+        // Статистика каждого кадра добавляется в начале следующего, так что с кадра WARMUP_FRAMES + 1
+        // по WARMUP_FRAMES + numFrames_ включительно собраны ровно numFrames_ кадров - те же кадры,
+        // которые измеряет таймер.
+
+        String scenario = ToString("sprites %u, rotated %.2f, scaled %.2f, animated %.2f, textures %u, pattern %s, "
+            "sort %d%s%s%s%s%s",
+            numSprites_, rotatedRatio_, scaledRatio_, animatedRatio_, numTextures_, pattern_.CString(), (int)sortMode_,
+            instancing_ ? ", instancing" : "", multiTexture_ ? ", multitexture" : "", bulk_ ? ", bulk" : "",
+            offscreen_ ? ", offscreen" : "", scissor_ ? ", scissor" : "");
+
+        String results = ToString("frame %.3f ms, sprites/sec %.0f, draw calls/frame %.1f, End() %.3f ms/frame, "
+            "uploaded %.2f MB/frame",
+            totalSeconds * 1000.0 / numFrames_,
+            numSpritesDrawn_ / totalSeconds,
+            (double)numDrawCalls_ / numFrames_,
+            endTime_ / 1000.0 / numFrames_,
+            bytesUploaded_ / (1024.0 * 1024.0) / numFrames_);
+
+        URHO3D_LOGINFO("Scenario: " + scenario);
+        URHO3D_LOGINFO("Results: " + results);
+        printf("Scenario: %s\nResults: %s\n", scenario.CString(), results.CString());
+    }
+};
+
+URHO3D_DEFINE_APPLICATION_MAIN(SpriteBatchBenchmark)
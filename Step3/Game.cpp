@@ -1,5 +1,8 @@
 #include <Urho3D/Urho3DAll.h>
 #include "SpriteBatch.h"
+#include "AsyncTexture.h"
+#include "SpriteEmitter.h"
+#include "ResourcePreloader.h"
 
 class Game : public Application
 {
@@ -9,6 +12,19 @@ public:
     // Пачка спрайтов.
     SharedPtr<SpriteBatch> spriteBatch_;
 
+    // Текстуры загружаются в фоновом потоке. Пока они не загружены, спрайты не выводятся.
+    SharedPtr<AsyncTexture> ball_;
+    SharedPtr<AsyncTexture> cursor_;
+
+    // Шрифт подписи мяча.
+    SharedPtr<Font> font_;
+
+    // Фонтан частиц внизу экрана. Частицы просчитываются видеокартой.
+    SharedPtr<SpriteEmitter> fountain_;
+
+    // Загружает ресурсы сцены, пока вместо нее выводится полоса загрузки. После загрузки удаляется.
+    SharedPtr<ResourcePreloader> preloader_;
+
     Game(Context* context) : Application(context)
     {
     }
@@ -18,6 +34,41 @@ public:
         engineParameters_[EP_FULL_SCREEN] = false;
         engineParameters_[EP_WINDOW_WIDTH] = 800;
         engineParameters_[EP_WINDOW_HEIGHT] = 600;
+        SetResourceDirs("Step3Data;Data;CoreData");
+    }
+
+    // Использует пакеты .pak вместо каталогов, если они есть (подробнее смотрите Step2).
+    void SetResourceDirs(const String& dirs)
+    {
+        FileSystem* fileSystem = GetSubsystem<FileSystem>();
+
+        String prefixParameter = engineParameters_.Contains(EP_RESOURCE_PREFIX_PATHS) ?
+            engineParameters_[EP_RESOURCE_PREFIX_PATHS].GetString() : String::EMPTY;
+        Vector<String> prefixes = prefixParameter.Split(';', true);
+        for (unsigned i = 0; i < prefixes.Size(); i++)
+        {
+            prefixes[i] = AddTrailingSlash(IsAbsolutePath(prefixes[i]) ? prefixes[i] :
+                fileSystem->GetProgramDir() + prefixes[i]);
+        }
+
+        Vector<String> paths;
+        Vector<String> packages;
+
+        Vector<String> names = dirs.Split(';');
+        for (unsigned i = 0; i < names.Size(); i++)
+        {
+            bool packed = false;
+            for (unsigned j = 0; j < prefixes.Size() && !packed; j++)
+                packed = fileSystem->FileExists(prefixes[j] + names[i] + ".pak");
+
+            if (packed)
+                packages.Push(names[i] + ".pak");
+            else
+                paths.Push(names[i]);
+        }
+
+        engineParameters_[EP_RESOURCE_PATHS] = String::Joined(paths, ";");
+        engineParameters_[EP_RESOURCE_PACKAGES] = String::Joined(packages, ";");
     }
 
     Vector2 ballPos_; // Текущее положение мяча.
@@ -28,6 +79,13 @@ public:
     {
         spriteBatch_ = new SpriteBatch(context_);
 
+        // Загружаем все ресурсы сцены заранее, чтобы первые кадры сцены не ждали диска. SpriteBatch создается
+        // раньше, так как он рисует полосу загрузки. Исходный код его шейдеров он уже загрузил, а в манифесте
+        // указаны вариации, которые нужно скомпилировать до первого кадра сцены.
+        preloader_ = new ResourcePreloader(context_);
+        preloader_->LoadManifest("Manifest.xml");
+        preloader_->StartLoading();
+
         // Инициализируем генератор случайных чисел текущим временем,
         // чтобы при каждом запуске программы он выдавал уникальную последовательность.
         SetRandomSeed(Time::GetSystemTime());
@@ -40,13 +98,42 @@ public:
         // Задаем цвет фона окна.
         GetSubsystem<Renderer>()->GetDefaultZone()->SetFogColor(Color(0.4f, 0.5f, 0.8f));
 
+        SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(Game, HandleUpdate));
+        SubscribeToEvent(E_ENDALLVIEWSRENDER, URHO3D_HANDLER(Game, HandleEndAllViewsRender));
+    }
+
+    // Создает объекты сцены, когда ее ресурсы уже в кэше.
+    void CreateScene()
+    {
+        // Ресурсы ищутся по имени один раз, а не в каждом кадре.
+        ball_ = new AsyncTexture(context_, "Urho2D/Ball.png");
+        cursor_ = new AsyncTexture(context_, "Urho2D/greenspiral.png");
+        font_ = GetSubsystem<ResourceCache>()->GetResource<Font>("Fonts/Anonymous Pro.ttf");
+
+        // Частицы - уменьшенные мячи. Текстура задается, когда она загрузится.
+        fountain_ = new SpriteEmitter(context_);
+        fountain_->SetNumParticles(2000);
+        fountain_->SetPosition(Vector2(400.0f, 600.0f));
+        fountain_->SetLifetime(3.0f);
+        fountain_->SetDirection(-90.0f, 15.0f);
+        fountain_->SetSpeed(250.0f, 400.0f);
+        fountain_->SetGravity(Vector2(0.0f, 250.0f));
+        fountain_->SetScale(0.5f, 0.2f);
+        fountain_->SetColors(Color(0.5f, 0.8f, 1.0f), Color(0.5f, 0.8f, 1.0f, 0.0f));
+
         // Создаем отладочный худ.
         XMLFile* xmlFile = GetSubsystem<ResourceCache>()->GetResource<XMLFile>("UI/DefaultStyle.xml");
         DebugHud* debugHud = engine_->CreateDebugHud();
         debugHud->SetDefaultStyle(xmlFile);
+    }
 
-        SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(Game, HandleUpdate));
-        SubscribeToEvent(E_ENDALLVIEWSRENDER, URHO3D_HANDLER(Game, HandleEndAllViewsRender));
+    // Полоса загрузки по центру экрана.
+    void RenderLoadingBar()
+    {
+        spriteBatch_->Begin();
+        spriteBatch_->DrawRect(Rect(200.0f, 290.0f, 600.0f, 310.0f), Color::WHITE, 2.0f);
+        spriteBatch_->FillRect(Rect(204.0f, 294.0f, 204.0f + 392.0f * preloader_->GetProgress(), 306.0f), Color::WHITE);
+        spriteBatch_->End();
     }
 
     // Нода для источника звука. Не принадлежит ни одной сцене.
@@ -73,6 +160,16 @@ public:
         using namespace Update;
         float timeStep = eventData[P_TIMESTEP].GetFloat();
 
+        // Ресурсы завершаются в начале кадра (E_BEGINFRAME), так что к этому моменту загрузка могла закончиться.
+        if (preloader_)
+        {
+            if (preloader_->IsLoading())
+                return;
+
+            CreateScene();
+            preloader_.Reset();
+        }
+
         // Показываем / прячем отладочный худ при нажатии на F2.
         if (GetSubsystem<Input>()->GetKeyPress(KEY_F2))
             GetSubsystem<DebugHud>()->ToggleAll();
@@ -116,29 +213,49 @@ public:
 
         // Проигрываем звук отскока.
         if (wasBounce)
-            PlaySound("Data/Sounds/PlayerFistHit.wav");
+            PlaySound("Sounds/PlayerFistHit.wav");
     }
 
     void HandleEndAllViewsRender(StringHash eventType, VariantMap& eventData)
     {
-        ResourceCache* cache = GetSubsystem<ResourceCache>();
-        Texture2D* ball = cache->GetResource<Texture2D>("Urho2D/Ball.png");
-        Texture2D* cursor = cache->GetResource<Texture2D>("Urho2D/greenspiral.png");
-
         // Можно не задавать цвет зоны, а очищать экран так. Но это будет немного медленнее,
         // так как происходит повторная очистка.
         //GetSubsystem<Graphics>()->Clear(CLEAR_COLOR, Color::BLUE);
 
+        if (preloader_)
+        {
+            RenderLoadingBar();
+            return;
+        }
+
+        // Фонтан выводится под спрайтами. На CPU тратится время только на установку параметров эмиттера.
+        if (ball_->IsLoaded())
+        {
+            fountain_->SetTexture(ball_->Get());
+            spriteBatch_->RenderEmitter(fountain_);
+        }
+
         spriteBatch_->Begin();
 
         // Рисуем мяч.
-        spriteBatch_->Draw(ball, ballPos_, Color::WHITE, ballAngle_, Vector2(16.0f, 16.0f));
+        spriteBatch_->Draw(ball_, ballPos_, Color::WHITE, ballAngle_, Vector2(16.0f, 16.0f));
+
+        // Подписываем мяч его углом поворота. Подпись центрируется над мячом.
+        String label = String((int)ballAngle_);
+        Vector2 labelSize = spriteBatch_->MeasureString(font_, 14.0f, label);
+        spriteBatch_->DrawString(font_, 14.0f, label, ballPos_ - Vector2(0.0f, 20.0f), Color::YELLOW, 0.0f,
+            Vector2(labelSize.x_ * 0.5f, labelSize.y_));
 
         // Рисуем курсор.
         Vector2 cursorPos = Vector2(GetSubsystem<Input>()->GetMousePosition());
+
+        // Рамка вокруг экрана и линия от мяча к курсору. Примитивы выводятся тем же SpriteBatch.
+        spriteBatch_->DrawRect(Rect(0.0f, 0.0f, 800.0f, 600.0f), Color(1.0f, 1.0f, 1.0f, 0.5f), 4.0f);
+        spriteBatch_->DrawLine(ballPos_, cursorPos, Color(0.0f, 0.0f, 0.0f, 0.3f), 2.0f);
+
         // Масштаб курсора меняется в диапазоне [0.5, 1.0].
         float cursorScale = Cos(GetSubsystem<Time>()->GetElapsedTime() * 100.0f) * 0.25f + 0.75f;
-        spriteBatch_->Draw(cursor, cursorPos, Color::BLACK, 0.0f, Vector2(16.0f, 16.0f), cursorScale);
+        spriteBatch_->Draw(cursor_, cursorPos, Color::BLACK, 0.0f, Vector2(16.0f, 16.0f), cursorScale);
 
         spriteBatch_->End();
     }
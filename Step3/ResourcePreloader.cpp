@@ -0,0 +1,241 @@
+﻿#include "ResourcePreloader.h"
+
+// Сколько миллисекунд кадра можно тратить на завершение загрузки ресурсов (как ResourceCache
+// для фоновых загрузок по умолчанию). Ресурсы, которые не успели, завершаются в следующих кадрах.
+#define FINISH_TIME_MS 5
+
+ResourcePreloader::ResourcePreloader(Context* context) : Object(context),
+    loading_(false),
+    failed_(false),
+    numFinished_(0)
+{
+}
+
+ResourcePreloader::~ResourcePreloader()
+{
+    // Рабочие потоки обращаются к элементам entries_, поэтому задания нужно дождаться (включая
+    // низкоприоритетные задания загрузки). Основной поток при этом тоже выполняет задания.
+    if (loading_)
+        GetSubsystem<WorkQueue>()->Complete(0);
+}
+
+void ResourcePreloader::Add(StringHash type, const String& name)
+{
+    // Указатели на элементы entries_ переданы рабочим потокам, и массив нельзя перевыделять.
+    if (loading_)
+    {
+        URHO3D_LOGERROR("Could not add " + name + " to the preloader while loading");
+        return;
+    }
+
+    String sanitatedName = GetSubsystem<ResourceCache>()->SanitateResourceName(name);
+
+    // Один и тот же исходный код шейдера нужен нескольким вариациям.
+    for (unsigned i = 0; i < entries_.Size(); i++)
+    {
+        if (entries_[i].type_ == type && entries_[i].name_ == sanitatedName)
+            return;
+    }
+
+    PLEntry entry { type, sanitatedName, SharedPtr<Resource>(), false };
+    entries_.Push(entry);
+}
+
+void ResourcePreloader::AddShader(const String& name, const String& defines/* = String::EMPTY*/)
+{
+    // Graphics::GetShader() ищет исходный код шейдера в кэше под таким же именем.
+#ifdef URHO3D_OPENGL
+    Add<Shader>("Shaders/GLSL/" + name + ".glsl");
+#else
+    Add<Shader>("Shaders/HLSL/" + name + ".hlsl");
+#endif
+
+    PLShader shader { name, defines };
+    shaders_.Push(shader);
+}
+
+bool ResourcePreloader::LoadManifest(const String& fileName)
+{
+    // Сам манифест нужен только один раз и в кэше не остается.
+    SharedPtr<XMLFile> file = GetSubsystem<ResourceCache>()->GetTempResource<XMLFile>(fileName);
+    if (!file)
+        return false;
+
+    XMLElement root = file->GetRoot("manifest");
+    if (!root.NotNull())
+    {
+        URHO3D_LOGERROR("Invalid resource manifest " + fileName);
+        return false;
+    }
+
+    for (XMLElement element = root.GetChild("resource"); element.NotNull(); element = element.GetNext("resource"))
+        Add(StringHash(element.GetAttribute("type")), element.GetAttribute("name"));
+
+    for (XMLElement element = root.GetChild("shader"); element.NotNull(); element = element.GetNext("shader"))
+        AddShader(element.GetAttribute("name"), element.GetAttribute("defines"));
+
+    return true;
+}
+
+void ResourcePreloader::LoadResourceWork(const WorkItem* item, unsigned threadIndex)
+{
+    PLEntry* entry = static_cast<PLEntry*>(item->start_);
+    ResourcePreloader* preloader = static_cast<ResourcePreloader*>(item->aux_);
+    ResourceCache* cache = static_cast<ResourceCache*>(item->end_);
+
+    // Кэш ресурсов защищает поиск файлов мьютексом, поэтому GetFile() можно вызывать из разных потоков.
+    SharedPtr<File> file = cache->GetFile(entry->name_);
+    entry->success_ = file && entry->resource_->BeginLoad(*file);
+    entry->resource_->SetAsyncLoadState(entry->success_ ? ASYNC_SUCCESS : ASYNC_FAIL);
+
+    // Передаем ресурс основному потоку.
+    MutexLock lock(preloader->loadedMutex_);
+    preloader->loadedEntries_.Push(entry);
+}
+
+void ResourcePreloader::StartLoading()
+{
+    if (loading_)
+        return;
+
+    ResourceCache* cache = GetSubsystem<ResourceCache>();
+    WorkQueue* queue = GetSubsystem<WorkQueue>();
+
+    loading_ = true;
+    failed_ = false;
+    numFinished_ = 0;
+    readyEntries_.Clear();
+
+    // Ставим все ресурсы в очередь сразу, чтобы их загружали все потоки одновременно.
+    // До конца загрузки размер entries_ не меняется, так что указатели на элементы остаются верными.
+    for (unsigned i = 0; i < entries_.Size(); i++)
+    {
+        PLEntry& entry = entries_[i];
+
+        // Такие ресурсы не нужно загружать, они сразу завершаются в основном потоке.
+        if (cache->GetExistingResource(entry.type_, entry.name_))
+        {
+            entry.success_ = true;
+            readyEntries_.Push(&entry);
+            continue;
+        }
+
+        entry.resource_ = DynamicCast<Resource>(context_->CreateObject(entry.type_));
+        if (!entry.resource_)
+        {
+            URHO3D_LOGERROR("Could not preload unknown resource type for " + entry.name_);
+            readyEntries_.Push(&entry);
+            continue;
+        }
+
+        // По состоянию ASYNC_LOADING ресурсы понимают, что загружаются не в основном потоке
+        // (Texture2D, например, заранее вычисляет уровни мипмапов).
+        entry.resource_->SetName(entry.name_);
+        entry.resource_->SetAsyncLoadState(ASYNC_LOADING);
+
+        // Наименьший приоритет: Complete(M_MAX_UNSIGNED), которым SpriteBatch и движок каждый кадр дожидаются
+        // своих заданий, не ждет загрузки ресурсов. Потоки берут задания загрузки, когда кадру они не нужны.
+        SharedPtr<WorkItem> item = queue->GetFreeItem();
+        item->priority_ = 0;
+        item->workFunction_ = LoadResourceWork;
+        item->start_ = &entry;
+        item->end_ = cache;
+        item->aux_ = this;
+        queue->AddWorkItem(item);
+    }
+
+    // Без рабочих потоков задачи выполняются здесь же, в основном потоке.
+    if (!queue->GetNumThreads())
+        queue->Complete(0);
+
+    SubscribeToEvent(E_BEGINFRAME, URHO3D_HANDLER(ResourcePreloader, HandleBeginFrame));
+}
+
+void ResourcePreloader::FinishEntry(PLEntry& entry)
+{
+    if (entry.resource_)
+    {
+        if (entry.success_)
+            entry.success_ = entry.resource_->EndLoad();
+
+        entry.resource_->SetAsyncLoadState(ASYNC_DONE);
+
+        if (entry.success_)
+        {
+            entry.resource_->ResetUseTimer();
+            GetSubsystem<ResourceCache>()->AddManualResource(entry.resource_);
+        }
+    }
+
+    if (!entry.success_)
+    {
+        URHO3D_LOGERROR("Failed to preload resource " + entry.name_);
+        failed_ = true;
+    }
+
+    numFinished_++;
+
+    using namespace PreloadProgress;
+
+    VariantMap& eventData = GetEventDataMap();
+    eventData[P_NAME] = entry.name_;
+    eventData[P_SUCCESS] = entry.success_;
+    eventData[P_LOADED] = (int)numFinished_;
+    eventData[P_TOTAL] = (int)entries_.Size();
+    SendEvent(E_PRELOADPROGRESS, eventData);
+}
+
+void ResourcePreloader::HandleBeginFrame(StringHash eventType, VariantMap& eventData)
+{
+    HiresTimer timer;
+
+    {
+        MutexLock lock(loadedMutex_);
+        readyEntries_.Push(loadedEntries_);
+        loadedEntries_.Clear();
+    }
+
+    // Ресурсы завершаются в порядке готовности, а не в порядке манифеста: большая текстура
+    // не задерживает мелкие ресурсы, которые уже прочитаны.
+    unsigned numReady = 0;
+    while (numReady < readyEntries_.Size())
+    {
+        FinishEntry(*readyEntries_[numReady++]);
+
+        if (timer.GetUSec(false) >= FINISH_TIME_MS * 1000)
+            break;
+    }
+
+    readyEntries_.Erase(0, numReady);
+
+    if (numFinished_ < entries_.Size())
+        return;
+
+    CompileShaders();
+
+    entries_.Clear();
+    shaders_.Clear();
+    loading_ = false;
+    UnsubscribeFromEvent(E_BEGINFRAME);
+}
+
+void ResourcePreloader::CompileShaders()
+{
+    Graphics* graphics = GetSubsystem<Graphics>();
+    if (!graphics)
+        return;
+
+    // Компиляция шейдеров (и линковка программ в OpenGL) возможна только в основном потоке.
+    for (unsigned i = 0; i < shaders_.Size(); i++)
+    {
+        const PLShader& shader = shaders_[i];
+        ShaderVariation* vs = graphics->GetShader(VS, shader.name_, shader.defines_);
+        ShaderVariation* ps = graphics->GetShader(PS, shader.name_, shader.defines_);
+        graphics->SetShaders(vs, ps);
+
+        if (!vs || !vs->GetGPUObject() || !ps || !ps->GetGPUObject())
+            URHO3D_LOGERROR("Failed to compile shader " + shader.name_ + " (" + shader.defines_ + ")");
+    }
+
+    graphics->SetShaders(nullptr, nullptr);
+}
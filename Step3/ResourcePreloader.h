@@ -0,0 +1,112 @@
+﻿/*
+    Предварительная загрузка ресурсов сцены (текстур, шрифтов, звуков, шейдеров) по списку - манифесту.
+    Без нее ресурсы загружаются при первом обращении, и первые кадры (например, первый отскок мяча со звуком)
+    задерживаются на чтение файлов и декодирование.
+
+    Чтение и декодирование файлов (Resource::BeginLoad()) выполняется параллельно во всех потоках WorkQueue,
+    а завершение загрузки (Resource::EndLoad(), где создаются объекты видеокарты) - в основном потоке в начале
+    кадра, так же как при фоновой загрузке ResourceCache::BackgroundLoadResource(). Кадры при этом продолжают
+    рендериться, и игра может выводить полосу загрузки по GetProgress() или по событию E_PRELOADPROGRESS,
+    которое посылается после завершения каждого ресурса.
+
+    Формат манифеста:
+    <manifest>
+        <resource type="Texture2D" name="Urho2D/Ball.png" />
+        <shader name="SpriteBatch" defines="PARTICLES" />
+    </manifest>
+    Для шейдера загружается исходный код, а вариация с указанными define-ами компилируется после загрузки
+    всех ресурсов.
+*/
+
+#pragma once
+
+#include <Urho3D/Urho3DAll.h>
+
+// Завершилась загрузка очередного ресурса.
+URHO3D_EVENT(E_PRELOADPROGRESS, PreloadProgress)
+{
+    URHO3D_PARAM(P_NAME, Name);       // String
+    URHO3D_PARAM(P_SUCCESS, Success); // bool
+    URHO3D_PARAM(P_LOADED, Loaded);   // int, сколько ресурсов уже обработано
+    URHO3D_PARAM(P_TOTAL, Total);     // int
+}
+
+class ResourcePreloader : public Object
+{
+    URHO3D_OBJECT(ResourcePreloader, Object);
+
+public:
+    ResourcePreloader(Context* context);
+
+    // Если загрузка не закончена, ждет завершения заданий, которые уже выполняются в рабочих потоках.
+    virtual ~ResourcePreloader();
+
+    // Добавляет ресурс в список. Ресурсы, которые уже есть в кэше, не загружаются повторно.
+    // Во время загрузки список менять нельзя.
+    void Add(StringHash type, const String& name);
+    template <class T> void Add(const String& name) { Add(T::GetTypeStatic(), name); }
+
+    // Добавляет исходный код шейдера и вариацию, которую нужно скомпилировать.
+    void AddShader(const String& name, const String& defines = String::EMPTY);
+
+    // Добавляет все ресурсы из XML-файла манифеста.
+    bool LoadManifest(const String& fileName);
+
+    // Начинает загрузку всех добавленных ресурсов и сразу возвращает управление. Готовые ресурсы попадают
+    // в кэш, и обычный ResourceCache::GetResource() потом находит их без обращения к диску.
+    void StartLoading();
+
+    // Загрузка начата и еще не закончена.
+    bool IsLoading() const { return loading_; }
+
+    // Доля обработанных ресурсов от 0 до 1. До начала и после окончания загрузки равна 1.
+    float GetProgress() const { return loading_ && entries_.Size() ? (float)numFinished_ / entries_.Size() : 1.0f; }
+
+    // Хотя бы один ресурс не загрузился.
+    bool IsFailed() const { return failed_; }
+
+private:
+    // Ресурс из списка.
+    struct PLEntry
+    {
+        StringHash type_;
+        String name_;
+        SharedPtr<Resource> resource_;
+        bool success_;
+    };
+
+    // Вариация шейдера для компиляции.
+    struct PLShader
+    {
+        String name_;
+        String defines_;
+    };
+
+    Vector<PLEntry> entries_;
+    Vector<PLShader> shaders_;
+
+    bool loading_;
+    bool failed_;
+    unsigned numFinished_;
+
+    // Элементы entries_, для которых рабочий поток закончил BeginLoad(). Рабочие потоки добавляют их сюда
+    // под мьютексом, поэтому основной поток, забрав их под тем же мьютексом, видит все, что записал поток
+    // (success_ и загруженные данные ресурса).
+    PODVector<PLEntry*> loadedEntries_;
+    Mutex loadedMutex_;
+
+    // Забранные из loadedEntries_ элементы, которые еще не успели завершиться в основном потоке.
+    PODVector<PLEntry*> readyEntries_;
+
+    // Выполняется в потоке WorkQueue: читает файл ресурса и вызывает BeginLoad().
+    static void LoadResourceWork(const WorkItem* item, unsigned threadIndex);
+
+    // Завершает ресурс в основном потоке и посылает E_PRELOADPROGRESS.
+    void FinishEntry(PLEntry& entry);
+
+    // В начале кадра завершает загрузку готовых ресурсов, пока не истечет отведенное на это время.
+    void HandleBeginFrame(StringHash eventType, VariantMap& eventData);
+
+    // Компилирует вариации шейдеров, устанавливая каждую пару (как CreatePermutations() в Step2).
+    void CompileShaders();
+};
@@ -0,0 +1,31 @@
+﻿#include "SpriteAnimation.h"
+
+SpriteAnimation::SpriteAnimation(Texture2D* texture, float fps, AnimationLoop loop/* = ANIMATION_LOOP*/) :
+    texture_(texture),
+    fps_(fps),
+    loop_(loop)
+{
+}
+
+SpriteAnimation::~SpriteAnimation()
+{
+}
+
+void SpriteAnimation::AddFrame(const IntRect& rect)
+{
+    frames_.Push(rect);
+}
+
+void SpriteAnimation::AddFrames(const IntRect& firstFrame, unsigned count, unsigned columns)
+{
+    columns = Max(columns, 1u);
+    int width = firstFrame.Width();
+    int height = firstFrame.Height();
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        int left = firstFrame.left_ + (int)(i % columns) * width;
+        int top = firstFrame.top_ + (int)(i / columns) * height;
+        frames_.Push(IntRect(left, top, left + width, top + height));
+    }
+}
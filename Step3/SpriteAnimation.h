@@ -0,0 +1,84 @@
+﻿/*
+    Покадровая анимация (flipbook): последовательность прямоугольников в одной текстуре (атласе),
+    которые сменяют друг друга с частотой fps. Анимация не хранит текущий кадр - кадр вычисляется
+    из времени при выводе спрайта, поэтому игре не нужно обновлять анимированные спрайты каждый кадр.
+    Одна анимация может использоваться любым числом спрайтов (SpriteBatch::Draw(SpriteAnimation*, ...)),
+    и все они попадают в одну порцию, так как текстура у них общая.
+*/
+
+#pragma once
+
+#include <Urho3D/Urho3DAll.h>
+
+// Что происходит после последнего кадра.
+enum AnimationLoop
+{
+    // Анимация начинается сначала.
+    ANIMATION_LOOP = 0,
+
+    // Остается последний кадр.
+    ANIMATION_ONCE,
+
+    // Кадры выводятся в прямом порядке, потом в обратном и так далее: 0, 1, 2, 1, 0, 1, 2...
+    ANIMATION_PINGPONG
+};
+
+class SpriteAnimation : public RefCounted
+{
+public:
+    SpriteAnimation(Texture2D* texture, float fps, AnimationLoop loop = ANIMATION_LOOP);
+    virtual ~SpriteAnimation();
+
+    // Добавляет кадр (прямоугольник в текстуре в пикселях). Размеры кадров должны совпадать:
+    // спрайт отсекается по размеру кадра, записанного в него при вызове Draw().
+    void AddFrame(const IntRect& rect);
+
+    // Добавляет count кадров, расположенных сеткой: слева направо по columns кадров в ряду, затем сверху вниз.
+    // firstFrame - прямоугольник первого кадра, остальные имеют такой же размер.
+    void AddFrames(const IntRect& firstFrame, unsigned count, unsigned columns);
+
+    Texture2D* GetTexture() const { return texture_; }
+    float GetFps() const { return fps_; }
+    AnimationLoop GetLoop() const { return loop_; }
+    unsigned GetNumFrames() const { return frames_.Size(); }
+
+    // Длительность одного прохода анимации в секундах.
+    float GetDuration() const { return fps_ > 0.0f ? frames_.Size() / fps_ : 0.0f; }
+
+    // Номер кадра через time секунд после начала анимации. Вызывается для каждого анимированного спрайта
+    // при выводе, поэтому определена здесь, чтобы компилятор мог ее встроить.
+    unsigned GetFrameIndex(float time) const
+    {
+        unsigned numFrames = frames_.Size();
+        if (numFrames <= 1 || time <= 0.0f)
+            return 0;
+
+        unsigned frame = (unsigned)(time * fps_);
+
+        switch (loop_)
+        {
+        case ANIMATION_ONCE:
+            return Min(frame, numFrames - 1);
+
+        case ANIMATION_PINGPONG:
+        {
+            // Крайние кадры не повторяются, поэтому период на два кадра меньше удвоенного числа кадров.
+            unsigned period = numFrames * 2 - 2;
+            frame %= period;
+            return frame < numFrames ? frame : period - frame;
+        }
+
+        default:
+            return frame % numFrames;
+        }
+    }
+
+    // Прямоугольник кадра через time секунд после начала анимации. Анимация должна содержать хотя бы один кадр.
+    const IntRect& GetFrame(float time) const { return frames_[GetFrameIndex(time)]; }
+
+private:
+    SharedPtr<Texture2D> texture_;
+    PODVector<IntRect> frames_;
+    float fps_;
+    AnimationLoop loop_;
+};
@@ -1,34 +1,100 @@
 ﻿#include "SpriteBatch.h"
+#include "SpriteLayer.h"
+#include "AsyncTexture.h"
+#include "SpriteAnimation.h"
+#include "SpriteEmitter.h"
 
-// Спрайт состоит из двух треугольников, а значит у него 6 вершин.
-// То есть каждый спрайт занимает 6 элементов в индексном буфере.
-#define INDICES_PER_SPRITE 6
+#ifdef URHO3D_SSE
+#include <emmintrin.h>
+#endif
 
-// Две вершины спрайта идентичны для обоих треугольников, поэтому
-// в вершинном буфере каждый спрайт занимает 4 элемента.
-#define VERTICES_PER_SPRITE 4
+// Порции меньше этого размера заполняются в основном потоке. Для маленьких порций
+// накладные расходы на раздачу заданий рабочим потокам больше, чем выигрыш.
+#define MIN_SPRITES_PER_TASK 1024
 
-// Максимальное число выводимых за один Draw Call спрайтов.
-// В полной версии https://github.com/1vanK/Urho3DSpriteBatch
-// используется более корректное значение.
-#define MAX_PORTION_SIZE 2000
+// Размер участка вершинного буфера (в спрайтах), который блокируется за раз в режиме SORT_IMMEDIATE.
+// Заранее неизвестно, сколько спрайтов будет в порции, а в OpenGL при разблокировке в видеокарту
+// передается весь заблокированный участок, поэтому он не должен быть слишком большим.
+#define IMMEDIATE_LOCK_SIZE 1024
 
-// Атрибуты вершин.
-struct SBVertex
+// Ключ сортировки SORT_TEXTURE 32-битный: по 16 бит на номер состояния и номер текстуры. Номера больше этого
+// значения объединяются в одну группу. Спрайты при этом выводятся правильно, но хуже группируются.
+#define MAX_SORT_ID 0xFFFF
+
+// Данные одного спрайта для инстансинга (смотрите шейдер SpriteBatch).
+// 52 байта вместо 4 * 24 = 96 байт для четырех вершин.
+struct SBInstance
 {
-    Vector3 position_;
+    Vector4 positionOrigin_;    // xy - позиция, zw - начало координат спрайта.
+    Vector4 sizeRotationScale_; // xy - размер, z - угол поворота в радианах, w - масштаб.
+    Vector4 uvRect_;            // Текстурные координаты левого верхнего и правого нижнего углов.
     unsigned color_;
-    Vector2 uv_;
 };
 
-SpriteBatch::SpriteBatch(Context *context) : Object(context)
+// Параметры шейдера частиц (в шейдере cParticleTime и т.д.).
+static const StringHash VSP_PARTICLETIME("ParticleTime");
+static const StringHash VSP_PARTICLEEMITTER("ParticleEmitter");
+static const StringHash VSP_PARTICLEMOTION("ParticleMotion");
+static const StringHash VSP_PARTICLESIZE("ParticleSize");
+static const StringHash VSP_PARTICLESPIN("ParticleSpin");
+static const StringHash VSP_PARTICLEUV("ParticleUV");
+static const StringHash VSP_PARTICLESTARTCOLOR("ParticleStartColor");
+static const StringHash VSP_PARTICLEENDCOLOR("ParticleEndColor");
+
+// Таблица синусов для TableSinCos(). Заполняется при первом обращении (инициализация локальной
+// статической переменной потокобезопасна, а вершины могут вычисляться в рабочих потоках).
+struct SBSinTable
 {
-    // Индексный буфер никогда не меняется, поэтому мы можем его сразу заполнить.
-    indexBuffer_ = new IndexBuffer(context_);
-    indexBuffer_->SetShadowed(true);
-    indexBuffer_->SetSize(MAX_PORTION_SIZE * INDICES_PER_SPRITE, false);
-    unsigned short* buffer = (unsigned short*)indexBuffer_->Lock(0, indexBuffer_->GetIndexCount());
-    for (unsigned i = 0; i < MAX_PORTION_SIZE; i++)
+    float values_[SB_ROTATION_TABLE_SIZE];
+
+    SBSinTable()
+    {
+        for (unsigned i = 0; i < SB_ROTATION_TABLE_SIZE; i++)
+            values_[i] = Sin(i * 360.0f / SB_ROTATION_TABLE_SIZE);
+    }
+};
+
+void SpriteBatch::TableSinCos(float angle, float& sin, float& cos)
+{
+    static const SBSinTable table;
+
+    // Размер таблицы - степень двойки, поэтому переход через 360 градусов (в том числе для отрицательных углов)
+    // выполняется битовой маской. Косинус - это синус угла, большего на 90 градусов (четверть таблицы).
+    const unsigned mask = SB_ROTATION_TABLE_SIZE - 1;
+    unsigned index = (unsigned)RoundToInt(angle * (SB_ROTATION_TABLE_SIZE / 360.0f));
+    sin = table.values_[index & mask];
+    cos = table.values_[(index + SB_ROTATION_TABLE_SIZE / 4) & mask];
+}
+
+// Синус и косинус угла поворота спрайта.
+static inline void SpriteSinCos(float angle, float& sin, float& cos)
+{
+#ifdef SB_ROTATION_TABLE
+    SpriteBatch::TableSinCos(angle, sin, cos);
+#else
+    SinCos(angle, sin, cos);
+#endif
+}
+
+SBTransform SBTransform::FromSprite(const Vector2& position, float rotation/* = 0.0f*/,
+    const Vector2& origin/* = Vector2::ZERO*/, float scale/* = 1.0f*/)
+{
+    // Вывод формул смотрите в SpriteBatch::WriteVerticesScalar().
+    float sin, cos;
+    SpriteSinCos(rotation, sin, cos);
+
+    return SBTransform
+    {
+        cos*scale, -sin*scale, -origin.x_*cos*scale + origin.y_*sin*scale + position.x_,
+        sin*scale,  cos*scale, -origin.x_*sin*scale - origin.y_*cos*scale + position.y_,
+        0.0f,       0.0f
+    };
+}
+
+// Заполняет индексный буфер для spriteCount спрайтов. Тип индексов T - unsigned short или unsigned.
+template <class T> static void FillIndices(T* buffer, unsigned spriteCount)
+{
+    for (unsigned i = 0; i < spriteCount; i++)
     {
         // Первый треугольник спрайта.
         buffer[i * INDICES_PER_SPRITE + 0] = i * VERTICES_PER_SPRITE + 0;
@@ -40,60 +106,1133 @@ SpriteBatch::SpriteBatch(Context *context) : Object(context)
         buffer[i * INDICES_PER_SPRITE + 4] = i * VERTICES_PER_SPRITE + 3;
         buffer[i * INDICES_PER_SPRITE + 5] = i * VERTICES_PER_SPRITE + 0;
     }
-    indexBuffer_->Unlock();
+}
+
+void SpriteBatch::FillIndexBuffer(IndexBuffer* indexBuffer, unsigned spriteCount)
+{
+    // 32-битные индексы используются, только если номера вершин не помещаются в 16-ти битные.
+    bool largeIndices = spriteCount > MAX_SHORT_PORTION_SIZE;
+
+    indexBuffer->SetShadowed(true);
+    indexBuffer->SetSize(spriteCount * INDICES_PER_SPRITE, largeIndices);
+    void* buffer = indexBuffer->Lock(0, indexBuffer->GetIndexCount());
+    if (largeIndices)
+        FillIndices((unsigned*)buffer, spriteCount);
+    else
+        FillIndices((unsigned short*)buffer, spriteCount);
+    indexBuffer->Unlock();
+}
+
+void SpriteBatch::SetVertexBufferSize(VertexBuffer* vertexBuffer, unsigned spriteCount, bool dynamic)
+{
+    // Формат задается списком атрибутов (более новый способ из первого примера),
+    // так как битовой маской нельзя описать 2D-координаты.
+    PODVector<VertexElement> elements;
+#ifdef SB_COMPACT_VERTICES
+    elements.Push(VertexElement(TYPE_VECTOR2, SEM_POSITION));
+#else
+    elements.Push(VertexElement(TYPE_VECTOR3, SEM_POSITION));
+#endif
+    elements.Push(VertexElement(TYPE_UBYTE4_NORM, SEM_COLOR));
+    elements.Push(VertexElement(TYPE_VECTOR2, SEM_TEXCOORD));
+
+    vertexBuffer->SetSize(spriteCount * VERTICES_PER_SPRITE, elements, dynamic);
+}
+
+// Определения нужны, так как константы передаются по ссылке (например, в Max()).
+const unsigned SpriteBatch::MAX_SHORT_PORTION_SIZE;
+const unsigned SpriteBatch::MAX_BATCH_TEXTURES;
+
+SpriteBatch::SpriteBatch(Context *context, unsigned maxPortionSize/* = MAX_SHORT_PORTION_SIZE*/) : Object(context),
+    maxPortionSize_(Max(maxPortionSize, 1u)),
+    bufferPosition_(0),
+    sortMode_(SORT_DEFERRED),
+    culling_(true),
+    userCullRect_(IntRect::ZERO),
+    numCulled_(0),
+    lastTexture_(nullptr),
+    instancing_(false),
+    instancePosition_(0),
+    immediateVertices_(nullptr),
+    immediateCapacity_(0),
+    immediateCount_(0),
+    immediateTexture_(nullptr),
+    immediateInvTextureW_(0.0f),
+    immediateInvTextureH_(0.0f),
+    immediateState_(0),
+    numPrimitives_(0),
+    animationTime_(0.0f),
+    currentState_(0),
+    appliedState_(M_MAX_UNSIGNED),
+    multiTexture_(false),
+    numPortionTextures_(0),
+    projectionSize_(IntVector2::ZERO),
+    projectionFlipped_(false),
+    projectionDepth_(false),
+    target_(nullptr),
+    clearTarget_(false),
+    clearDepth_(false),
+    targetSet_(false)
+{
+    // Вместимость вершинного буфера (в спрайтах). Буфер используется как кольцевой: очередная порция
+    // записывается после предыдущей, и только когда место заканчивается, запись начинается сначала.
+    // Меньше, чем помещается в 16-ти битные индексы, выделять нет смысла.
+    bufferSize_ = Max(maxPortionSize_, MAX_SHORT_PORTION_SIZE);
+
+    // Индексный буфер никогда не меняется, поэтому мы можем его сразу заполнить.
+    // Он покрывает весь вершинный буфер, так как порция может начинаться с любого места.
+    indexBuffer_ = new IndexBuffer(context_);
+    FillIndexBuffer(indexBuffer_, bufferSize_);
 
     vertexBuffer_ = new VertexBuffer(context_);
-    vertexBuffer_->SetSize(MAX_PORTION_SIZE * VERTICES_PER_SPRITE,
-                           MASK_POSITION | MASK_COLOR | MASK_TEXCOORD1, true);
+    SetVertexBufferSize(vertexBuffer_, bufferSize_, true);
+
+    // Немного ускоряем доступ к подсистемам.
+    graphics_ = GetSubsystem<Graphics>();
+    workQueue_ = GetSubsystem<WorkQueue>();
+
+    // Используем стандартный шейдер.
+    vs_ = graphics_->GetShader(VS, "Basic", "DIFFMAP VERTEXCOLOR");
+    ps_ = graphics_->GetShader(PS, "Basic", "DIFFMAP VERTEXCOLOR");
+
+    // Для инстансинга используется собственный шейдер.
+    instancingVs_ = graphics_->GetShader(VS, "SpriteBatch", "INSTANCED");
+    instancingPs_ = graphics_->GetShader(PS, "SpriteBatch", "INSTANCED");
+
+    // Шейдеры для режима нескольких текстур.
+    multiTextureVs_ = graphics_->GetShader(VS, "SpriteBatch", "MULTITEXTURE");
+    multiTexturePs_ = graphics_->GetShader(PS, "SpriteBatch", "MULTITEXTURE");
+    instancingMultiTextureVs_ = graphics_->GetShader(VS, "SpriteBatch", "INSTANCED MULTITEXTURE");
+    instancingMultiTexturePs_ = graphics_->GetShader(PS, "SpriteBatch", "INSTANCED MULTITEXTURE");
+
+    // Шейдеры частиц.
+    particleVs_ = graphics_->GetShader(VS, "SpriteBatch", "PARTICLES");
+    particlePs_ = graphics_->GetShader(PS, "SpriteBatch", "PARTICLES");
+
+    // Текстура для примитивов.
+    SharedPtr<Image> whiteImage(new Image(context_));
+    whiteImage->SetSize(1, 1, 4);
+    whiteImage->SetPixel(0, 0, Color::WHITE);
+    whiteTexture_ = new Texture2D(context_);
+    whiteTexture_->SetData(whiteImage);
+
+    memset(&stats_, 0, sizeof(stats_));
+    memset(&lastFrameStats_, 0, sizeof(lastFrameStats_));
+    SubscribeToEvent(E_BEGINFRAME, URHO3D_HANDLER(SpriteBatch, HandleBeginFrame));
+}
+
+void SpriteBatch::HandleBeginFrame(StringHash eventType, VariantMap& eventData)
+{
+    lastFrameStats_ = stats_;
+    memset(&stats_, 0, sizeof(stats_));
+    lastTexture_ = nullptr;
+
+    // Удаляем раскладки строк, которые не выводились в прошлом кадре.
+    for (HashMap<unsigned, SBTextLayout>::Iterator i = textLayouts_.Begin(); i != textLayouts_.End();)
+    {
+        if (!i->second_.used_)
+        {
+            i = textLayouts_.Erase(i);
+        }
+        else
+        {
+            i->second_.used_ = false;
+            ++i;
+        }
+    }
+
+    DebugHud* debugHud = GetSubsystem<DebugHud>();
+    if (!debugHud)
+        return;
+
+    debugHud->SetAppStats("SpriteBatch sprites", String(lastFrameStats_.numSprites_));
+    debugHud->SetAppStats("SpriteBatch culled", String(lastFrameStats_.numCulled_));
+    debugHud->SetAppStats("SpriteBatch draw calls", String(lastFrameStats_.numDrawCalls_));
+    debugHud->SetAppStats("SpriteBatch texture switches", String(lastFrameStats_.numTextureSwitches_));
+    debugHud->SetAppStats("SpriteBatch uploaded KB", String(lastFrameStats_.bytesUploaded_ / 1024));
+    debugHud->SetAppStats("SpriteBatch End() ms", String(lastFrameStats_.endTime_ / 1000.0f));
+}
+
+SpriteBatch::~SpriteBatch()
+{
+}
+
+void SpriteBatch::SetInstancing(bool enable)
+{
+    if (enable && !graphics_->GetInstancingSupport())
+    {
+        URHO3D_LOGWARNING("SpriteBatch: instancing is not supported");
+        enable = false;
+    }
+
+    instancing_ = enable;
+
+    // Буферы уже созданы или не нужны.
+    if (!instancing_ || instanceBuffer_)
+        return;
+
+    CreateQuadBuffers();
+
+    // Атрибуты с флагом perInstance берутся из буфера не для каждой вершины, а для каждого экземпляра.
+    // Шейдер получает их как iTexCoord4, iTexCoord5, iTexCoord6 и iColor.
+    PODVector<VertexElement> elements;
+    elements.Push(VertexElement(TYPE_VECTOR4, SEM_TEXCOORD, 4, true));
+    elements.Push(VertexElement(TYPE_VECTOR4, SEM_TEXCOORD, 5, true));
+    elements.Push(VertexElement(TYPE_VECTOR4, SEM_TEXCOORD, 6, true));
+    elements.Push(VertexElement(TYPE_UBYTE4_NORM, SEM_COLOR, 0, true));
+    instanceBuffer_ = new VertexBuffer(context_);
+    instanceBuffer_->SetSize(bufferSize_, elements, true);
+
+    instancingBuffers_.Push(quadVertexBuffer_);
+    instancingBuffers_.Push(instanceBuffer_);
+}
+
+void SpriteBatch::CreateQuadBuffers()
+{
+    if (quadVertexBuffer_)
+        return;
+
+    // Единичный квадрат. Вершины задаются по часовой стрелке с учетом того, что ось Y направлена вниз.
+    quadVertexBuffer_ = new VertexBuffer(context_);
+    quadVertexBuffer_->SetShadowed(true);
+    quadVertexBuffer_->SetSize(VERTICES_PER_SPRITE, MASK_POSITION);
+    Vector3 corners[VERTICES_PER_SPRITE] =
+    {
+        Vector3(0.0f, 0.0f, 0.0f),
+        Vector3(1.0f, 0.0f, 0.0f),
+        Vector3(1.0f, 1.0f, 0.0f),
+        Vector3(0.0f, 1.0f, 0.0f)
+    };
+    quadVertexBuffer_->SetData(corners);
+
+    quadIndexBuffer_ = new IndexBuffer(context_);
+    quadIndexBuffer_->SetShadowed(true);
+    quadIndexBuffer_->SetSize(INDICES_PER_SPRITE, false);
+    FillIndices((unsigned short*)quadIndexBuffer_->Lock(0, INDICES_PER_SPRITE), 1);
+    quadIndexBuffer_->Unlock();
+}
+
+void SpriteBatch::Begin(SortMode sortMode/* = SORT_DEFERRED*/)
+{
+    Begin(sortMode, (RenderSurface*)nullptr);
+}
+
+void SpriteBatch::Begin(SortMode sortMode, Texture2D* target, bool clearTarget/* = true*/)
+{
+    Begin(sortMode, target ? target->GetRenderSurface() : nullptr, clearTarget);
+}
+
+void SpriteBatch::Begin(SortMode sortMode, RenderSurface* target, bool clearTarget/* = true*/)
+{
+    // Очищаем старый список спрайтов.
+    sprites_.Clear();
+
+    sortMode_ = sortMode;
+
+#ifdef SB_COMPACT_VERTICES
+    // В компактных вершинах нет координаты Z, и глубину некуда записать.
+    if (sortMode_ == SORT_LAYERED)
+        sortMode_ = SORT_BACKTOFRONT;
+#endif
+
+    target_ = target;
+    clearTarget_ = clearTarget;
+    targetSet_ = false;
+
+    // Размер области вывода - размер текстуры или окна.
+    int width = target_ ? target_->GetWidth() : graphics_->GetWidth();
+    int height = target_ ? target_->GetHeight() : graphics_->GetHeight();
+
+#ifdef URHO3D_OPENGL
+    UpdateViewProjMatrix(width, height, target_ != nullptr, sortMode_ == SORT_LAYERED);
+#else
+    UpdateViewProjMatrix(width, height, false, sortMode_ == SORT_LAYERED);
+#endif
+
+    // Область отсечения - вся область вывода или заданный пользователем прямоугольник.
+    if (userCullRect_ == IntRect::ZERO)
+        cullRect_ = Rect(0.0f, 0.0f, (float)width, (float)height);
+    else
+        cullRect_ = Rect((float)userCullRect_.left_, (float)userCullRect_.top_,
+                         (float)userCullRect_.right_, (float)userCullRect_.bottom_);
+
+    numCulled_ = 0;
+
+    // Список для каждого рабочего потока и для основного. Потоки создаются при инициализации движка,
+    // поэтому их число к этому моменту уже известно.
+    threadBuffers_.Resize(workQueue_->GetNumThreads() + 1);
+    for (unsigned i = 0; i < threadBuffers_.Size(); i++)
+    {
+        threadBuffers_[i].sprites_.Clear();
+        threadBuffers_[i].numCulled_ = 0;
+    }
+
+    immediateTexture_ = nullptr;
+
+    // Спрайты прошлого кадра уже выведены, и блоки трансформаций примитивов можно заполнять заново.
+    numPrimitives_ = 0;
+
+    // Все анимированные спрайты кадра используют одно и то же время.
+    animationTime_ = GetSubsystem<Time>()->GetElapsedTime();
+
+    // Состояние по умолчанию всегда имеет номер 0.
+    states_.Clear();
+    SBRenderState defaultState { BLEND_ALPHA, nullptr, nullptr, IntRect::ZERO };
+    states_.Push(defaultState);
+    currentState_ = 0;
+    appliedState_ = M_MAX_UNSIGNED;
+}
+
+void SpriteBatch::SelectState(const SBRenderState& state)
+{
+    // Состояний обычно немного, поэтому достаточно линейного поиска.
+    for (unsigned i = 0; i < states_.Size(); i++)
+    {
+        if (states_[i] == state)
+        {
+            currentState_ = i;
+            return;
+        }
+    }
+
+    currentState_ = states_.Size();
+    states_.Push(state);
+
+    if (currentState_ == MAX_SORT_ID + 1)
+        URHO3D_LOGWARNING("SpriteBatch: too many render states, SORT_TEXTURE will not group the rest");
+}
+
+void SpriteBatch::SetBlendMode(BlendMode mode)
+{
+    SBRenderState state = states_[currentState_];
+    state.blendMode_ = mode;
+    SelectState(state);
+}
+
+void SpriteBatch::SetShaders(ShaderVariation* vs, ShaderVariation* ps)
+{
+    SBRenderState state = states_[currentState_];
+    state.vs_ = vs;
+    state.ps_ = ps;
+    SelectState(state);
+}
+
+void SpriteBatch::SetScissor(const IntRect& rect)
+{
+    SBRenderState state = states_[currentState_];
+    state.scissor_ = rect;
+    SelectState(state);
+}
+
+void SpriteBatch::ApplyState(unsigned index, ShaderVariation* defaultVs, ShaderVariation* defaultPs)
+{
+    if (index == appliedState_)
+        return;
+
+    const SBRenderState& state = states_[index];
+
+    graphics_->SetShaders(state.vs_ ? state.vs_ : defaultVs, state.ps_ ? state.ps_ : defaultPs);
+
+    // Параметры шейдеров устанавливаются после смены шейдеров.
+    SetRenderState();
+    graphics_->SetBlendMode(state.blendMode_);
+
+    // Непрозрачные спрайты записывают глубину, и видеокарта отбрасывает закрытые ими пиксели более дальних
+    // спрайтов еще до выполнения пиксельного шейдера. Полупрозрачные только проверяют глубину.
+    if (sortMode_ == SORT_LAYERED)
+    {
+        graphics_->SetDepthTest(CMP_LESSEQUAL);
+        graphics_->SetDepthWrite(state.blendMode_ == BLEND_REPLACE);
+    }
+
+    if (state.scissor_ == IntRect::ZERO)
+    {
+        graphics_->SetScissorTest(false);
+    }
+    else if (projectionFlipped_)
+    {
+        // Изображение в текстуре перевернуто по вертикали (смотрите UpdateViewProjMatrix()),
+        // поэтому область отсечения переворачивается так же (как в UI::Render()).
+        IntRect scissor = state.scissor_;
+        scissor.top_ = projectionSize_.y_ - state.scissor_.bottom_;
+        scissor.bottom_ = projectionSize_.y_ - state.scissor_.top_;
+        graphics_->SetScissorTest(true, scissor);
+    }
+    else
+    {
+        graphics_->SetScissorTest(true, state.scissor_);
+    }
+
+    appliedState_ = index;
+}
+
+bool SpriteBatch::IsVisible(const SBSprite& sprite) const
+{
+    float w = (float)sprite.sourceRect_.Width();
+    float h = (float)sprite.sourceRect_.Height();
+
+    // Для заранее вычисленной трансформации проверяем прямоугольник, ограничивающий углы спрайта.
+    if (sprite.transform_)
+    {
+        // Из-за слагаемых m03 и m13 четырехугольник может не быть параллелограммом,
+        // поэтому угол (w, h) вычисляется отдельно.
+        const SBTransform& t = *sprite.transform_;
+        float x1 = t.m00_ * w;
+        float y1 = t.m10_ * w;
+        float x2 = t.m00_ * w + t.m01_ * h + t.m03_ * w * h;
+        float y2 = t.m10_ * w + t.m11_ * h + t.m13_ * w * h;
+        float x3 = t.m01_ * h;
+        float y3 = t.m11_ * h;
+        float minX = t.m02_ + Min(Min(0.0f, x1), Min(x2, x3));
+        float maxX = t.m02_ + Max(Max(0.0f, x1), Max(x2, x3));
+        float minY = t.m12_ + Min(Min(0.0f, y1), Min(y2, y3));
+        float maxY = t.m12_ + Max(Max(0.0f, y1), Max(y2, y3));
+        return maxX >= cullRect_.min_.x_ && minX <= cullRect_.max_.x_ &&
+               maxY >= cullRect_.min_.y_ && minY <= cullRect_.max_.y_;
+    }
+
+    // Спрайт при любом повороте находится внутри окружности с центром в точке origin,
+    // проходящей через самый дальний от origin угол спрайта.
+    float dx = Max(Abs(sprite.origin_.x_), Abs(w - sprite.origin_.x_));
+    float dy = Max(Abs(sprite.origin_.y_), Abs(h - sprite.origin_.y_));
+    float radiusSquared = (dx * dx + dy * dy) * sprite.scale_ * sprite.scale_;
+
+    // Расстояние от центра окружности (позиции спрайта) до области отсечения.
+    // Если центр внутри области, то расстояние равно нулю.
+    const Vector2& pos = sprite.position_;
+    float distanceX = Max(Max(cullRect_.min_.x_ - pos.x_, pos.x_ - cullRect_.max_.x_), 0.0f);
+    float distanceY = Max(Max(cullRect_.min_.y_ - pos.y_, pos.y_ - cullRect_.max_.y_), 0.0f);
+
+    // Сравниваем квадраты, чтобы не вычислять корень.
+    return distanceX * distanceX + distanceY * distanceY <= radiusSquared;
+}
+
+void SpriteBatch::Draw(Texture2D* texture, const Vector2& position, const Color& color/* = Color::WHITE*/,
+    float rotation/* = 0.0f*/, const Vector2 &origin/* = Vector2::ZERO*/, float scale/* = 1.0f*/,
+    float layerDepth/* = 0.0f*/)
+{
+    // Выводится вся текстура.
+    IntRect sourceRect(0, 0, texture->GetWidth(), texture->GetHeight());
+    Draw(texture, sourceRect, position, color, rotation, origin, scale, layerDepth);
+}
+
+void SpriteBatch::Draw(Texture2D* texture, const IntRect& sourceRect, const Vector2& position,
+    const Color& color/* = Color::WHITE*/, float rotation/* = 0.0f*/, const Vector2 &origin/* = Vector2::ZERO*/,
+    float scale/* = 1.0f*/, float layerDepth/* = 0.0f*/)
+{
+    SBSprite sprite { texture, sourceRect, position, color, rotation, origin, scale, layerDepth, currentState_, nullptr,
+                      nullptr, 0.0f };
+    AddSprite(sprite);
+}
+
+void SpriteBatch::Draw(Texture2D* texture, const IntRect& sourceRect, const SBTransform* transform,
+    const Color& color/* = Color::WHITE*/, float layerDepth/* = 0.0f*/)
+{
+    SBSprite sprite { texture, sourceRect, Vector2::ZERO, color, 0.0f, Vector2::ZERO, 1.0f, layerDepth, currentState_,
+                      transform, nullptr, 0.0f };
+    AddSprite(sprite);
+}
+
+void SpriteBatch::DrawQuad(const Vector2& c0, const Vector2& c1, const Vector2& c2, const Vector2& c3,
+    const Color& color, float layerDepth)
+{
+    // Блоки по 1024 трансформации.
+    unsigned blockIndex = numPrimitives_ >> 10;
+    if (blockIndex == primitiveBlocks_.Size())
+        primitiveBlocks_.Push(SharedArrayPtr<SBTransform>(new SBTransform[1024]));
+
+    SBTransform& t = primitiveBlocks_[blockIndex][numPrimitives_ & 1023];
+    numPrimitives_++;
+
+    // Спрайт размером 1x1 отображается в четырехугольник: (0, 0) -> c0, (1, 0) -> c1, (1, 1) -> c2, (0, 1) -> c3.
+    t.m00_ = c1.x_ - c0.x_;
+    t.m01_ = c3.x_ - c0.x_;
+    t.m02_ = c0.x_;
+    t.m10_ = c1.y_ - c0.y_;
+    t.m11_ = c3.y_ - c0.y_;
+    t.m12_ = c0.y_;
+    t.m03_ = c2.x_ - c1.x_ - c3.x_ + c0.x_;
+    t.m13_ = c2.y_ - c1.y_ - c3.y_ + c0.y_;
+
+    Draw(whiteTexture_, IntRect(0, 0, 1, 1), &t, color, layerDepth);
+}
+
+void SpriteBatch::DrawLine(const Vector2& start, const Vector2& end, const Color& color/* = Color::WHITE*/,
+    float thickness/* = 1.0f*/, float layerDepth/* = 0.0f*/)
+{
+    Vector2 direction = end - start;
+    float length = direction.Length();
+    if (length < M_EPSILON)
+        return;
+
+    // Нормаль к линии длиной в половину толщины. Поворот направления на 90 градусов по часовой стрелке
+    // (ось Y направлена вниз) сохраняет порядок обхода углов, как у обычного спрайта.
+    Vector2 normal = Vector2(-direction.y_, direction.x_) * (thickness * 0.5f / length);
+    DrawQuad(start - normal, end - normal, end + normal, start + normal, color, layerDepth);
+}
+
+void SpriteBatch::FillRect(const Rect& rect, const Color& color/* = Color::WHITE*/, float layerDepth/* = 0.0f*/)
+{
+    DrawQuad(rect.min_, Vector2(rect.max_.x_, rect.min_.y_), rect.max_, Vector2(rect.min_.x_, rect.max_.y_),
+             color, layerDepth);
+}
+
+void SpriteBatch::DrawRect(const Rect& rect, const Color& color/* = Color::WHITE*/, float thickness/* = 1.0f*/,
+    float layerDepth/* = 0.0f*/)
+{
+    // Стороны не перекрываются, иначе у полупрозрачного контура углы были бы темнее.
+    float t = Min(thickness, Min(rect.Size().x_, rect.Size().y_) * 0.5f);
+    FillRect(Rect(rect.min_.x_, rect.min_.y_, rect.max_.x_, rect.min_.y_ + t), color, layerDepth);
+    FillRect(Rect(rect.min_.x_, rect.max_.y_ - t, rect.max_.x_, rect.max_.y_), color, layerDepth);
+    FillRect(Rect(rect.min_.x_, rect.min_.y_ + t, rect.min_.x_ + t, rect.max_.y_ - t), color, layerDepth);
+    FillRect(Rect(rect.max_.x_ - t, rect.min_.y_ + t, rect.max_.x_, rect.max_.y_ - t), color, layerDepth);
+}
+
+void SpriteBatch::FillPolygon(const Vector2* points, unsigned count, const Color& color/* = Color::WHITE*/,
+    float layerDepth/* = 0.0f*/)
+{
+    if (count < 3)
+        return;
+
+    // Удвоенная площадь со знаком. Если она отрицательная, вершины перечислены против часовой стрелки
+    // (с учетом того, что ось Y направлена вниз), и такие треугольники были бы отброшены при рендеринге.
+    float area = 0.0f;
+    for (unsigned i = 0; i < count; i++)
+    {
+        const Vector2& a = points[i];
+        const Vector2& b = points[(i + 1) % count];
+        area += a.x_ * b.y_ - b.x_ * a.y_;
+    }
+
+    // В этом случае обходим вершины в обратном порядке.
+    bool reverse = area < 0.0f;
+    auto point = [=](unsigned index) -> const Vector2& { return points[reverse ? count - 1 - index : index]; };
+
+    // Выпуклый многоугольник разбивается на веер четырехугольников с общей вершиной 0. Каждый четырехугольник
+    // покрывает два треугольника веера. Если остается один треугольник, его последняя вершина повторяется.
+    for (unsigned i = 1; i + 1 < count; i += 2)
+    {
+        const Vector2& c2 = point(i + 1);
+        const Vector2& c3 = i + 2 < count ? point(i + 2) : c2;
+        DrawQuad(point(0), point(i), c2, c3, color, layerDepth);
+    }
+}
+
+void SpriteBatch::AddSprite(const SBSprite& sprite)
+{
+    // Спрайт за пределами экрана не нужно ни обрабатывать, ни передавать в видеокарту.
+    if (culling_ && !IsVisible(sprite))
+    {
+        numCulled_++;
+        stats_.numCulled_++;
+        return;
+    }
+
+    // В этом режиме спрайт сразу превращается в вершины.
+    if (sortMode_ == SORT_IMMEDIATE)
+    {
+        DrawImmediate(sprite);
+        return;
+    }
+
+    // Добавляем очередной спрайт в список.
+    sprites_.Push(sprite);
+}
+
+void SpriteBatch::Draw(Sprite2D* sprite, const Vector2& position, const Color& color/* = Color::WHITE*/,
+    float rotation/* = 0.0f*/, const Vector2 &origin/* = Vector2::ZERO*/, float scale/* = 1.0f*/,
+    float layerDepth/* = 0.0f*/)
+{
+    Draw(sprite->GetTexture(), sprite->GetRectangle(), position, color, rotation, origin, scale, layerDepth);
+}
+
+void SpriteBatch::Draw(AsyncTexture* texture, const Vector2& position, const Color& color/* = Color::WHITE*/,
+    float rotation/* = 0.0f*/, const Vector2 &origin/* = Vector2::ZERO*/, float scale/* = 1.0f*/,
+    float layerDepth/* = 0.0f*/)
+{
+    Texture2D* loaded = texture->Get();
+
+    if (loaded)
+        Draw(loaded, position, color, rotation, origin, scale, layerDepth);
+    else if (placeholderTexture_)
+        Draw(placeholderTexture_, position, color, rotation, origin, scale, layerDepth);
+}
+
+void SpriteBatch::Draw(AsyncTexture* texture, const IntRect& sourceRect, const Vector2& position,
+    const Color& color/* = Color::WHITE*/, float rotation/* = 0.0f*/, const Vector2 &origin/* = Vector2::ZERO*/,
+    float scale/* = 1.0f*/, float layerDepth/* = 0.0f*/)
+{
+    Texture2D* loaded = texture->Get();
+
+    if (loaded)
+        Draw(loaded, sourceRect, position, color, rotation, origin, scale, layerDepth);
+    else if (placeholderTexture_)
+        Draw(placeholderTexture_, sourceRect, position, color, rotation, origin, scale, layerDepth);
+}
+
+void SpriteBatch::Draw(const SpriteAnimation* animation, float startTime, const Vector2& position,
+    const Color& color/* = Color::WHITE*/, float rotation/* = 0.0f*/, const Vector2 &origin/* = Vector2::ZERO*/,
+    float scale/* = 1.0f*/, float layerDepth/* = 0.0f*/)
+{
+    // У пустой анимации нет кадра, который можно было бы записать в спрайт.
+    if (!animation->GetTexture() || animation->GetNumFrames() == 0)
+        return;
+
+    // Текущий кадр будет выбран при рендеринге, а пока записываем первый (для отсечения).
+    SBSprite sprite { animation->GetTexture(), animation->GetFrame(0.0f), position, color, rotation, origin, scale,
+                      layerDepth, currentState_, nullptr, animation, startTime };
+    AddSprite(sprite);
+}
+
+void SpriteBatch::SelectAnimationFrame(SBSprite& sprite) const
+{
+    if (sprite.animation_)
+        sprite.sourceRect_ = sprite.animation_->GetFrame(animationTime_ - sprite.animationStart_);
+}
+
+const SpriteBatch::SBTextLayout* SpriteBatch::GetTextLayout(Font* font, float fontSize, const String& text)
+{
+    FontFace* face = font->GetFace(fontSize);
+    if (!face)
+        return nullptr;
+
+    unsigned key = StringHash(text).Value() * 31 + MakeHash(face);
+    SBTextLayout& layout = textLayouts_[key];
+    layout.used_ = true;
+
+    // Раскладка уже вычислена.
+    if (layout.face_.Get() == face && layout.text_ == text)
+        return &layout;
+
+    layout.face_ = face;
+    layout.text_ = text;
+    layout.glyphs_.Clear();
+    layout.size_ = Vector2::ZERO;
+
+    const Vector<SharedPtr<Texture2D> >& textures = face->GetTextures();
+    float rowHeight = face->GetRowHeight();
+    float x = 0.0f;
+    float y = 0.0f;
+
+    unsigned byteOffset = 0;
+    unsigned c = text.NextUTF8Char(byteOffset);
+
+    while (c)
+    {
+        unsigned next = text.NextUTF8Char(byteOffset);
+
+        if (c == '\n')
+        {
+            layout.size_.x_ = Max(layout.size_.x_, x);
+            x = 0.0f;
+            y += rowHeight;
+            c = next;
+            continue;
+        }
+
+        const FontGlyph* glyph = face->GetGlyph(c);
+        if (glyph)
+        {
+            // У пробела нет изображения, только смещение.
+            if (glyph->width_ > 0 && glyph->height_ > 0 && glyph->page_ < textures.Size())
+            {
+                SBGlyph sbGlyph { textures[glyph->page_],
+                                  IntRect(glyph->x_, glyph->y_, glyph->x_ + glyph->width_, glyph->y_ + glyph->height_),
+                                  Vector2(x + glyph->offsetX_, y + glyph->offsetY_) };
+                layout.glyphs_.Push(sbGlyph);
+            }
+
+            x += glyph->advanceX_;
+            if (next)
+                x += face->GetKerning(c, next);
+        }
+
+        c = next;
+    }
+
+    layout.size_.x_ = Max(layout.size_.x_, x);
+    layout.size_.y_ = y + rowHeight;
+
+    return &layout;
+}
+
+void SpriteBatch::DrawString(Font* font, float fontSize, const String& text, const Vector2& position,
+    const Color& color/* = Color::WHITE*/, float rotation/* = 0.0f*/, const Vector2 &origin/* = Vector2::ZERO*/,
+    float scale/* = 1.0f*/, float layerDepth/* = 0.0f*/)
+{
+    const SBTextLayout* layout = GetTextLayout(font, fontSize, text);
+    if (!layout)
+        return;
+
+    // Все символы поворачиваются и масштабируются вокруг общей точки: для символа со смещением offset
+    // начало координат сдвигается на -offset. Символы одной страницы шрифта идут подряд и попадают в одну порцию.
+    for (unsigned i = 0; i < layout->glyphs_.Size(); i++)
+    {
+        const SBGlyph& glyph = layout->glyphs_[i];
+        Draw(glyph.texture_, glyph.sourceRect_, position, color, rotation, origin - glyph.offset_, scale, layerDepth);
+    }
+}
+
+Vector2 SpriteBatch::MeasureString(Font* font, float fontSize, const String& text)
+{
+    const SBTextLayout* layout = GetTextLayout(font, fontSize, text);
+    return layout ? layout->size_ : Vector2::ZERO;
+}
+
+void SpriteBatch::DrawBulk(const SBSprite* sprites, unsigned count)
+{
+    if (sortMode_ == SORT_IMMEDIATE)
+    {
+        for (unsigned i = 0; i < count; i++)
+        {
+            if (culling_ && !IsVisible(sprites[i]))
+            {
+                numCulled_++;
+                stats_.numCulled_++;
+                continue;
+            }
+
+            if (sprites[i].state_ >= states_.Size())
+            {
+                URHO3D_LOGERROR("SpriteBatch: sprite has an invalid state_, the default state is used");
+                SBSprite sprite = sprites[i];
+                sprite.state_ = 0;
+                DrawImmediate(sprite);
+                continue;
+            }
+
+            DrawImmediate(sprites[i]);
+        }
+
+        return;
+    }
+
+    unsigned oldSize = sprites_.Size();
+    sprites_.Resize(oldSize + count);
+    memcpy(sprites_.Buffer() + oldSize, sprites, count * sizeof(SBSprite));
+
+    if (!culling_)
+        return;
+
+    // Уплотняем добавленную часть массива, выбрасывая невидимые спрайты.
+    SBSprite* dest = sprites_.Buffer() + oldSize;
+    for (unsigned i = oldSize; i < sprites_.Size(); i++)
+    {
+        if (IsVisible(sprites_[i]))
+            *dest++ = sprites_[i];
+    }
+
+    unsigned numVisible = (unsigned)(dest - sprites_.Buffer()) - oldSize;
+    numCulled_ += count - numVisible;
+    stats_.numCulled_ += count - numVisible;
+    sprites_.Resize(oldSize + numVisible);
+}
+
+SpriteBatch::SBSprite* SpriteBatch::AllocateSprites(unsigned count)
+{
+    unsigned oldSize = sprites_.Size();
+    sprites_.Resize(oldSize + count);
+    return sprites_.Buffer() + oldSize;
+}
+
+void SpriteBatch::DrawFromThread(unsigned threadIndex, Texture2D* texture, const IntRect& sourceRect,
+    const Vector2& position, const Color& color/* = Color::WHITE*/, float rotation/* = 0.0f*/,
+    const Vector2 &origin/* = Vector2::ZERO*/, float scale/* = 1.0f*/, float layerDepth/* = 0.0f*/)
+{
+    SBThreadBuffer& buffer = threadBuffers_[threadIndex];
+    SBSprite sprite { texture, sourceRect, position, color, rotation, origin, scale, layerDepth, currentState_, nullptr,
+                      nullptr, 0.0f };
+
+    // IsVisible() только читает cullRect_, поэтому ее можно вызывать из любого потока.
+    if (culling_ && !IsVisible(sprite))
+    {
+        buffer.numCulled_++;
+        return;
+    }
+
+    buffer.sprites_.Push(sprite);
+}
+
+void SpriteBatch::DrawBulkFromThread(unsigned threadIndex, const SBSprite* sprites, unsigned count)
+{
+    SBThreadBuffer& buffer = threadBuffers_[threadIndex];
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (culling_ && !IsVisible(sprites[i]))
+            buffer.numCulled_++;
+        else
+            buffer.sprites_.Push(sprites[i]);
+    }
+}
+
+void SpriteBatch::MergeThreadBuffers()
+{
+    unsigned count = sprites_.Size();
+    for (unsigned i = 0; i < threadBuffers_.Size(); i++)
+        count += threadBuffers_[i].sprites_.Size();
+
+    // Выделяем память один раз.
+    sprites_.Reserve(count);
+
+    for (unsigned i = 0; i < threadBuffers_.Size(); i++)
+    {
+        SBThreadBuffer& buffer = threadBuffers_[i];
+        sprites_.Push(buffer.sprites_);
+        numCulled_ += buffer.numCulled_;
+        stats_.numCulled_ += buffer.numCulled_;
+
+        // Память списка не освобождается и будет использована в следующем кадре.
+        buffer.sprites_.Clear();
+        buffer.numCulled_ = 0;
+    }
+}
+
+void SpriteBatch::ValidateSpriteStates()
+{
+    unsigned numStates = states_.Size();
+    unsigned numInvalid = 0;
+
+    for (unsigned i = 0; i < sprites_.Size(); i++)
+    {
+        if (sprites_[i].state_ >= numStates)
+        {
+            sprites_[i].state_ = 0;
+            numInvalid++;
+        }
+    }
+
+    // Одно сообщение на кадр, а не на каждый спрайт.
+    if (numInvalid)
+        URHO3D_LOGERROR("SpriteBatch: " + String(numInvalid) + " sprites have an invalid state_, the default state is used");
+}
+
+void SpriteBatch::Reserve(unsigned numSprites)
+{
+    // Массив sortedSprites_ меняется местами с sprites_ после сортировки, поэтому резервируем оба.
+    sprites_.Reserve(numSprites);
+    sortedSprites_.Reserve(numSprites);
+    sortKeys_.Reserve(numSprites);
+    sortIndices_.Reserve(numSprites);
+    tempKeys_.Reserve(numSprites);
+    tempIndices_.Reserve(numSprites);
+}
+
+// Преобразует float в unsigned так, чтобы порядок беззнаковых чисел совпадал с порядком исходных float.
+// У положительных чисел инвертируется знаковый бит, у отрицательных - все биты.
+static inline unsigned FloatToSortKey(float value)
+{
+    unsigned bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & 0x80000000) ? ~bits : bits | 0x80000000;
+}
+
+// Поразрядная сортировка (LSD radix sort) пар ключ-индекс по 8 бит за проход.
+// Сортировка устойчивая, то есть спрайты с одинаковыми ключами сохраняют порядок вызова Draw().
+// Результат оказывается в keys и indices, tempKeys и tempIndices используются как промежуточные буферы.
+static void RadixSort(PODVector<unsigned>& keys, PODVector<unsigned>& indices,
+    PODVector<unsigned>& tempKeys, PODVector<unsigned>& tempIndices)
+{
+    unsigned count = keys.Size();
+    tempKeys.Resize(count);
+    tempIndices.Resize(count);
+
+    for (unsigned shift = 0; shift < 32; shift += 8)
+    {
+        // Подсчитываем, сколько раз встречается каждое значение текущего байта.
+        unsigned offsets[256] = { 0 };
+        for (unsigned i = 0; i < count; i++)
+            offsets[(keys[i] >> shift) & 0xFF]++;
+
+        // Если у всех ключей этот байт одинаковый, то проход ничего не изменит.
+        // Например, при сортировке по текстурам обычно нужен только один проход из четырех.
+        if (offsets[(keys[0] >> shift) & 0xFF] == count)
+            continue;
+
+        // Превращаем количества в начальные позиции групп.
+        unsigned sum = 0;
+        for (unsigned i = 0; i < 256; i++)
+        {
+            unsigned groupSize = offsets[i];
+            offsets[i] = sum;
+            sum += groupSize;
+        }
+
+        // Раскладываем элементы по группам.
+        for (unsigned i = 0; i < count; i++)
+        {
+            unsigned dest = offsets[(keys[i] >> shift) & 0xFF]++;
+            tempKeys[dest] = keys[i];
+            tempIndices[dest] = indices[i];
+        }
+
+        keys.Swap(tempKeys);
+        indices.Swap(tempIndices);
+    }
+}
+
+void SpriteBatch::SortSprites()
+{
+    // В этих режимах спрайты не сортируются.
+    if (sortMode_ == SORT_DEFERRED || sortMode_ == SORT_IMMEDIATE)
+        return;
+
+    unsigned count = sprites_.Size();
+    sortKeys_.Resize(count);
+    sortIndices_.Resize(count);
+
+    if (sortMode_ == SORT_TEXTURE)
+    {
+        // Вместо указателя на текстуру используем ее порядковый номер. Номера маленькие,
+        // поэтому сортировка обычно выполняется за один проход.
+        textureIds_.Clear();
+        Texture2D* lastTexture = nullptr;
+        unsigned lastId = 0;
+
+        for (unsigned i = 0; i < count; i++)
+        {
+            Texture2D* texture = sprites_[i].texture_;
+
+            // Соседние спрайты часто используют одну и ту же текстуру, поэтому можно не обращаться к хэш-таблице.
+            if (texture != lastTexture)
+            {
+                HashMap<Texture2D*, unsigned>::Iterator it = textureIds_.Find(texture);
+                if (it == textureIds_.End())
+                {
+                    lastId = textureIds_.Size();
+                    textureIds_[texture] = lastId;
+
+                    if (lastId == MAX_SORT_ID + 1)
+                        URHO3D_LOGWARNING("SpriteBatch: too many textures, SORT_TEXTURE will not group the rest");
+                }
+                else
+                {
+                    lastId = it->second_;
+                }
+
+                lastTexture = texture;
+            }
+
+            // Старшие биты ключа - номер состояния, поэтому спрайты группируются сначала по состояниям,
+            // а внутри состояния - по текстурам.
+            sortKeys_[i] = (Min(sprites_[i].state_, (unsigned)MAX_SORT_ID) << 16) | Min(lastId, (unsigned)MAX_SORT_ID);
+            sortIndices_[i] = i;
+        }
+    }
+    else if (sortMode_ == SORT_LAYERED)
+    {
+        // Старший бит ключа - проход: сначала непрозрачные спрайты (от ближних к дальним), затем полупрозрачные
+        // (от дальних к ближним). Для глубины остается 31 бит.
+        for (unsigned i = 0; i < count; i++)
+        {
+            unsigned key = FloatToSortKey(sprites_[i].layerDepth_);
+            bool opaque = states_[sprites_[i].state_].blendMode_ == BLEND_REPLACE;
+            sortKeys_[i] = opaque ? key >> 1 : (~key >> 1) | 0x80000000;
+            sortIndices_[i] = i;
+        }
+    }
+    else
+    {
+        // При сортировке от дальних к ближним большая глубина должна идти первой, поэтому ключ инвертируется.
+        bool backToFront = sortMode_ == SORT_BACKTOFRONT;
+
+        for (unsigned i = 0; i < count; i++)
+        {
+            unsigned key = FloatToSortKey(sprites_[i].layerDepth_);
+            sortKeys_[i] = backToFront ? ~key : key;
+            sortIndices_[i] = i;
+        }
+    }
+
+    RadixSort(sortKeys_, sortIndices_, tempKeys_, tempIndices_);
+
+    // Переставляем сами спрайты. Они значительно больше пар ключ-индекс, поэтому
+    // копируются один раз, а не на каждом проходе сортировки.
+    sortedSprites_.Resize(count);
+    for (unsigned i = 0; i < count; i++)
+        sortedSprites_[i] = sprites_[sortIndices_[i]];
+
+    sprites_.Swap(sortedSprites_);
+}
+
+void SpriteBatch::End()
+{
+    // Спрайты уже в вершинном буфере, осталось нарисовать последнюю порцию.
+    if (sortMode_ == SORT_IMMEDIATE)
+        FlushImmediate();
+
+    // Задания WorkQueue к этому моменту завершены, и списки потоков больше не меняются.
+    MergeThreadBuffers();
+    ValidateSpriteStates();
+
+    if (sprites_.Size() != 0)
+        RenderSprites();
+    else
+        SetTarget(); // Даже если спрайтов нет, текстура должна быть очищена.
+
+    // Область отсечения не должна влиять на то, что рендерится после спрайтов.
+    graphics_->SetScissorTest(false);
+
+    // Дальнейший рендеринг идет на экран.
+    if (targetSet_)
+    {
+        graphics_->ResetRenderTargets();
+        targetSet_ = false;
+    }
+}
+
+void SpriteBatch::SetTarget()
+{
+    if (!target_ || targetSet_)
+        return;
+
+    graphics_->SetRenderTarget(0, target_);
+
+    // В режиме SORT_LAYERED нужен буфер глубины размером с текстуру (у FBO в OpenGL своего буфера нет).
+    // В остальных режимах глубина не используется, но в некоторых графических API размеры буферов должны
+    // совпадать, поэтому буфер экрана, который меньше текстуры, тоже заменяется. Подходящий буфер берем у Renderer.
+    int width = target_->GetWidth();
+    int height = target_->GetHeight();
+    bool layered = sortMode_ == SORT_LAYERED;
+    if (layered || width > graphics_->GetWidth() || height > graphics_->GetHeight())
+    {
+        graphics_->SetDepthStencil(GetSubsystem<Renderer>()->GetDepthStencil(width, height,
+                                   target_->GetMultiSample(), target_->GetAutoResolve()));
+    }
+
+    graphics_->SetViewport(IntRect(0, 0, width, height));
+
+    // Буфер глубины общий с другими текстурами того же размера, поэтому в режиме SORT_LAYERED
+    // он очищается всегда, даже если содержимое текстуры сохраняется.
+    unsigned clearFlags = (clearTarget_ ? CLEAR_COLOR : 0) | (layered ? CLEAR_DEPTH : 0);
+    if (clearFlags)
+        graphics_->Clear(clearFlags, Color(0.0f, 0.0f, 0.0f, 0.0f));
+
+    // Смотрите UpdateViewProjMatrix().
+    graphics_->SetCullMode(CULL_NONE);
+
+    targetSet_ = true;
+}
+
+void SpriteBatch::RenderSprites()
+{
+    URHO3D_PROFILE(SpriteBatchEnd);
+    HiresTimer timer;
+
+    stats_.numSprites_ += sprites_.Size();
+
+    // Упорядочиваем спрайты, чтобы спрайты с одинаковой текстурой шли подряд
+    // и попадали в одну порцию.
+    SortSprites();
+
+    SetTarget();
+
+    // Буфер глубины текстуры очищается в SetTarget(). Буфер экрана заполнен сценой
+    // и стирается, только если вызывающий это разрешил.
+    if (sortMode_ == SORT_LAYERED && !target_ && clearDepth_)
+        graphics_->Clear(CLEAR_DEPTH);
+
+    // В режиме SORT_LAYERED глубина спрайтов записывается в вершины, а в записях экземпляров для нее нет места,
+    // поэтому инстансинг не используется.
+    bool instancing = instancing_ && sortMode_ != SORT_LAYERED;
+
+    // Шейдеры по умолчанию (если в состоянии спрайтов не заданы свои).
+    ShaderVariation* defaultVs;
+    ShaderVariation* defaultPs;
+
+    if (instancing)
+    {
+        // Вершинные буферы устанавливаются в RenderPortionInstanced(), так как для каждой порции
+        // указывается свое смещение в буфере экземпляров.
+        graphics_->SetIndexBuffer(quadIndexBuffer_);
+
+        defaultVs = multiTexture_ ? instancingMultiTextureVs_ : instancingVs_;
+        defaultPs = multiTexture_ ? instancingMultiTexturePs_ : instancingPs_;
+    }
+    else
+    {
+        // Устанавливаем текущие буферы.
+        graphics_->SetVertexBuffer(vertexBuffer_);
+        graphics_->SetIndexBuffer(indexBuffer_);
+
+        defaultVs = multiTexture_ ? multiTextureVs_ : vs_;
+        defaultPs = multiTexture_ ? multiTexturePs_ : ps_;
+    }
+
+    // Шейдеры по умолчанию здесь могут отличаться от шейдеров режима SORT_IMMEDIATE, поэтому
+    // состояние устанавливается заново.
+    appliedState_ = M_MAX_UNSIGNED;
+    
+    // Индекс, с которого начинается очередная порция спрайтов.
+    unsigned startSpriteIndex = 0;
+    
+    // Выполняем, пока все спрайты из списка не будут отрисованы.
+    while (startSpriteIndex != sprites_.Size())
+    {
+        // Определяем число спрайтов с одинаковой текстурой.
+        unsigned count = GetPortionLength(startSpriteIndex, instancing);
 
-    // Немного ускоряем доступ к подсистеме.
-    graphics_ = GetSubsystem<Graphics>();
+        // Примитивы при инстансинге выводятся со своими шейдерами и буферами.
+        if (instancing && sprites_[startSpriteIndex].texture_ == whiteTexture_)
+        {
+            RenderPrimitivePortion(startSpriteIndex, count);
+            startSpriteIndex += count;
+            continue;
+        }
 
-    // Используем стандартный шейдер.
-    vs_ = graphics_->GetShader(VS, "Basic", "DIFFMAP VERTEXCOLOR");
-    ps_ = graphics_->GetShader(PS, "Basic", "DIFFMAP VERTEXCOLOR");
-}
+        // Режим смешивания, шейдеры и их параметры. Меняются, только если у порции другое состояние.
+        ApplyState(sprites_[startSpriteIndex].state_, defaultVs, defaultPs);
 
-SpriteBatch::~SpriteBatch()
-{
-}
+        // Рендерим очередную порцию.
+        if (instancing)
+            RenderPortionInstanced(startSpriteIndex, count);
+        else
+            RenderPortion(startSpriteIndex, count);
 
-void SpriteBatch::Begin()
-{
-    // Очищаем старый список спрайтов.
-    sprites_.Clear();
-}
+        startSpriteIndex += count;
+    }
 
-void SpriteBatch::Draw(Texture2D* texture, const Vector2& position, const Color& color/* = Color::WHITE*/,
-    float rotation/* = 0.0f*/, const Vector2 &origin/* = Vector2::ZERO*/, float scale/* = 1.0f*/)
-{
-    // Просто добавляем очередной спрайт в список.
-    SBSprite sprite { texture, position, color, rotation, origin, scale };
-    sprites_.Push(sprite);
+    stats_.endTime_ += timer.GetUSec(false);
 }
 
-void SpriteBatch::End()
+void SpriteBatch::SetRenderState()
 {
-    // Список спрайтов пуст.
-    if (sprites_.Size() == 0)
-        return;
-
     // Включаем альфа-смешивание.
     graphics_->SetBlendMode(BLEND_ALPHA);
 
-    // Устанавливаем текущие буферы.
-    graphics_->SetVertexBuffer(vertexBuffer_);
-    graphics_->SetIndexBuffer(indexBuffer_);
+    // Спрайты накладываются в порядке вывода без учета буфера глубины (кроме режима SORT_LAYERED, смотрите ApplyState()).
+    graphics_->SetDepthTest(CMP_ALWAYS);
+    graphics_->SetDepthWrite(false);
 
-    // Устанавливаем используемую шейдерную программу.
-    graphics_->SetShaders(vs_, ps_);
+    // Параметры шейдеров не меняются между вызовами End(), поэтому устанавливаются, только если
+    // их перезаписал кто-то другой или сменилась шейдерная программа. Graphics запоминает источник
+    // (указатель this) последних значений для каждой группы параметров.
 
     // Шейдер Basic требует это значение. Информацию о цвете спрайта мы храним
     // в вершинах, поэтому здесь просто белый цвет.
-    graphics_->SetShaderParameter(PSP_MATDIFFCOLOR, Color::WHITE);
+    if (graphics_->NeedParameterUpdate(SP_MATERIAL, this))
+        graphics_->SetShaderParameter(PSP_MATDIFFCOLOR, Color::WHITE);
 
     // Матрица модели не используется. Локальные и мировые координаты совпадают.
-    graphics_->SetShaderParameter(VSP_MODEL, Matrix3x4::IDENTITY);
+    if (graphics_->NeedParameterUpdate(SP_OBJECT, this))
+        graphics_->SetShaderParameter(VSP_MODEL, Matrix3x4::IDENTITY);
+
+    // Матрица вычисляется в UpdateViewProjMatrix().
+    if (graphics_->NeedParameterUpdate(SP_CAMERA, this))
+        graphics_->SetShaderParameter(VSP_VIEWPROJ, viewProjMatrix_);
+}
+
+void SpriteBatch::UpdateViewProjMatrix(int width, int height, bool flipVertical, bool depth)
+{
+    // Матрица зависит только от размеров области вывода, поэтому пересчитывается, только если они изменились
+    // (сменился размер окна или спрайты выводятся в текстуру).
+    if (width == projectionSize_.x_ && height == projectionSize_.y_ && flipVertical == projectionFlipped_ &&
+        depth == projectionDepth_)
+        return;
+
+    projectionSize_ = IntVector2(width, height);
+    projectionFlipped_ = flipVertical;
+    projectionDepth_ = depth;
 
     // Экранные координаты (не пиксели, а именно точки нулевого размера) находятся в диапазоне [-1, 1] по вертикали и горизонтали.
     // Для экранных координат ось Y направлена вверх.
@@ -121,51 +1260,208 @@ void SpriteBatch::End()
     // и из диапазона [0, screenHeight] в диапазон [0, 2] по вертикали, а затем сдвинет их на единицу, чтобы получился диапазон [-1, 1].
     // Заодно эта матрица должна поменять направление оси Y на противоположное.
     // Как составляются подобные матрицы показано в функции RenderPortion().
-    float w = (float)graphics_->GetWidth();
-    float h = (float)graphics_->GetHeight();
-    Matrix4 viewProjMatrix = Matrix4(2.0f / w, 0.0f,     0.0f, -1.0f,    // Эта строка умножает X на 2, делит на ширину окна, а потом вычитает 1.
-                                     0.0f,    -2.0f / h, 0.0f,  1.0f,    // Умножает Y на -2, делит на высоту, а потом прибавляет 1.
-                                     0.0f,     0.0f,     0.0f,  0.0f,    // Координату Z принудительно установим в 0.
-                                     0.0f,     0.0f,     0.0f,  1.0f);
-    graphics_->SetShaderParameter(VSP_VIEWPROJ, viewProjMatrix);
-    
-    // Индекс, с которого начинается очередная порция спрайтов.
-    unsigned startSpriteIndex = 0;
-    
-    // Выполняем, пока все спрайты из списка не будут отрисованы.
-    while (startSpriteIndex != sprites_.Size())
+    float w = (float)width;
+    float h = (float)height;
+    viewProjMatrix_ = Matrix4(2.0f / w, 0.0f,     0.0f, -1.0f,    // Эта строка умножает X на 2, делит на ширину окна, а потом вычитает 1.
+                              0.0f,    -2.0f / h, 0.0f,  1.0f,    // Умножает Y на -2, делит на высоту, а потом прибавляет 1.
+                              0.0f,     0.0f,     0.0f,  0.0f,    // Координату Z обнулим (кроме режима SORT_LAYERED).
+                              0.0f,     0.0f,     0.0f,  1.0f);
+
+    // В OpenGL строки текстуры хранятся снизу вверх, поэтому при выводе в текстуру изображение переворачивается
+    // (так же поступает и сам движок, смотрите Camera::SetFlipVertical()). Тогда текстура выглядит одинаково
+    // во всех графических API. Поворот ось Y меняет направление обхода вершин, поэтому в SetTarget()
+    // отключается отсечение граней.
+    // Глубина спрайта (layerDepth из диапазона [0, 1]) переводится в глубину экранных координат. В Direct3D
+    // она тоже находится в диапазоне [0, 1], а в OpenGL в диапазоне [-1, 1].
+    if (depth)
     {
-        // Определяем число спрайтов с одинаковой текстурой.
-        unsigned count = GetPortionLength(startSpriteIndex);
+#ifdef URHO3D_OPENGL
+        viewProjMatrix_.m22_ = 2.0f;
+        viewProjMatrix_.m23_ = -1.0f;
+#else
+        viewProjMatrix_.m22_ = 1.0f;
+#endif
+    }
 
-        // Рендерим очередную порцию.
-        RenderPortion(startSpriteIndex, count);
+    if (flipVertical)
+    {
+        viewProjMatrix_.m10_ = -viewProjMatrix_.m10_;
+        viewProjMatrix_.m11_ = -viewProjMatrix_.m11_;
+        viewProjMatrix_.m12_ = -viewProjMatrix_.m12_;
+        viewProjMatrix_.m13_ = -viewProjMatrix_.m13_;
+    }
 
-        startSpriteIndex += count;
+    // Параметры из этой группы будут установлены заново при следующем вызове SetRenderState().
+    graphics_->ClearParameterSource(SP_CAMERA);
+}
+
+void SpriteBatch::RenderLayer(SpriteLayer* layer)
+{
+    URHO3D_PROFILE(SpriteBatchRenderLayer);
+    HiresTimer timer;
+
+    // Загружаем в видеокарту измененные спрайты слоя (если такие есть).
+    layer->Update();
+
+    if (layer->GetNumSprites() == 0)
+        return;
+
+    // Слой всегда выводится на экран.
+    UpdateViewProjMatrix(graphics_->GetWidth(), graphics_->GetHeight(), false, false);
+
+    // Слой хранит собственные буферы, так что ничего не нужно вычислять, только установить состояние и нарисовать.
+    graphics_->SetVertexBuffer(layer->GetVertexBuffer());
+    graphics_->SetIndexBuffer(layer->GetIndexBuffer());
+    graphics_->SetShaders(vs_, ps_);
+    SetRenderState();
+
+    const PODVector<SpriteLayer::SLPortion>& portions = layer->GetPortions();
+    for (unsigned i = 0; i < portions.Size(); i++)
+    {
+        const SpriteLayer::SLPortion& portion = portions[i];
+        SetTexture(portion.texture_);
+        graphics_->Draw(TRIANGLE_LIST, portion.start_ * INDICES_PER_SPRITE, portion.count_ * INDICES_PER_SPRITE,
+                        portion.start_ * VERTICES_PER_SPRITE, portion.count_ * VERTICES_PER_SPRITE);
+    }
+
+    stats_.numSprites_ += layer->GetNumSprites();
+    stats_.numDrawCalls_ += portions.Size();
+    stats_.endTime_ += timer.GetUSec(false);
+}
+
+void SpriteBatch::RenderEmitter(SpriteEmitter* emitter)
+{
+    URHO3D_PROFILE(SpriteBatchRenderEmitter);
+
+    if (!graphics_->GetInstancingSupport())
+    {
+        URHO3D_LOGWARNING("SpriteBatch: particles require instancing support");
+        return;
+    }
+
+    Texture2D* texture = emitter->GetTexture();
+    if (!texture || emitter->GetNumParticles() == 0 || emitter->IsFinished())
+        return;
+
+    HiresTimer timer;
+
+    // Случайные числа частиц заполняются только при изменении их числа.
+    emitter->Update();
+    CreateQuadBuffers();
+
+    // Эмиттер, как и слой, всегда выводится на экран.
+    UpdateViewProjMatrix(graphics_->GetWidth(), graphics_->GetHeight(), false, false);
+
+    emitterBuffers_.Resize(2);
+    emitterBuffers_[0] = quadVertexBuffer_;
+    emitterBuffers_[1] = emitter->GetInstanceBuffer();
+    graphics_->SetVertexBuffers(emitterBuffers_);
+    graphics_->SetIndexBuffer(quadIndexBuffer_);
+
+    graphics_->SetShaders(particleVs_, particlePs_);
+    SetRenderState();
+    graphics_->SetBlendMode(emitter->GetBlendMode());
+
+    // Параметры эмиттера. Это все, что шейдер знает о частицах, кроме их случайных чисел.
+    // Углы передаются в радианах.
+    const IntRect& rect = emitter->GetSourceRect();
+    float invTextureW = 1.0f / texture->GetWidth();
+    float invTextureH = 1.0f / texture->GetHeight();
+    float duration = emitter->GetDuration() > 0.0f ? emitter->GetDuration() : M_LARGE_VALUE;
+
+    graphics_->SetShaderParameter(VSP_PARTICLETIME, Vector4(emitter->GetTime(), emitter->GetLifetime(),
+                                  duration, 0.0f));
+    graphics_->SetShaderParameter(VSP_PARTICLEEMITTER, Vector4(emitter->GetPosition().x_, emitter->GetPosition().y_,
+                                  emitter->GetDirection() * M_DEGTORAD, emitter->GetSpread() * M_DEGTORAD));
+    graphics_->SetShaderParameter(VSP_PARTICLEMOTION, Vector4(emitter->GetMinSpeed(), emitter->GetMaxSpeed(),
+                                  emitter->GetGravity().x_, emitter->GetGravity().y_));
+    graphics_->SetShaderParameter(VSP_PARTICLESIZE, Vector4((float)rect.Width(), (float)rect.Height(),
+                                  emitter->GetStartScale(), emitter->GetEndScale()));
+    graphics_->SetShaderParameter(VSP_PARTICLESPIN, Vector4(emitter->GetMinSpin() * M_DEGTORAD,
+                                  emitter->GetMaxSpin() * M_DEGTORAD, 0.0f, 0.0f));
+    graphics_->SetShaderParameter(VSP_PARTICLEUV, Vector4(rect.left_ * invTextureW, rect.top_ * invTextureH,
+                                  rect.right_ * invTextureW, rect.bottom_ * invTextureH));
+    graphics_->SetShaderParameter(VSP_PARTICLESTARTCOLOR, emitter->GetStartColor());
+    graphics_->SetShaderParameter(VSP_PARTICLEENDCOLOR, emitter->GetEndColor());
+
+    SetTexture(texture);
+    graphics_->DrawInstanced(TRIANGLE_LIST, 0, INDICES_PER_SPRITE, 0, VERTICES_PER_SPRITE, emitter->GetNumParticles());
+
+    stats_.numSprites_ += emitter->GetNumParticles();
+    stats_.numDrawCalls_++;
+    stats_.endTime_ += timer.GetUSec(false);
+
+    // Следующие спрайты должны установить свое состояние заново.
+    appliedState_ = M_MAX_UNSIGNED;
+}
+
+void SpriteBatch::SetTexture(Texture2D* texture)
+{
+    if (texture != lastTexture_)
+    {
+        stats_.numTextureSwitches_++;
+        lastTexture_ = texture;
     }
+
+    graphics_->SetTexture(TU_DIFFUSE, texture);
 }
 
-unsigned SpriteBatch::GetPortionLength(unsigned start)
+unsigned SpriteBatch::GetPortionLength(unsigned start, bool instancing)
 {
+    URHO3D_PROFILE(GetPortionLength);
+
+    // Текстуры, которые используются в порции. Без режима нескольких текстур она всегда одна.
+    unsigned maxTextures = multiTexture_ ? MAX_BATCH_TEXTURES : 1;
+    portionTextures_[0] = sprites_[start].texture_;
+    numPortionTextures_ = 1;
+
     unsigned count = 1;
 
     while (true)
     {
         // Порция уже максимального размера.
-        if (count >= MAX_PORTION_SIZE)
+        if (count >= maxPortionSize_)
             break;
 
         // Индекс следующего спрайта.
         unsigned nextSpriteIndex = start + count;
-        
+
         // Следующий спрайт выходит за пределы списка.
         if (nextSpriteIndex == sprites_.Size())
             break;
-        
-        // У следующего спрайта другая текстура.
-        if (sprites_[nextSpriteIndex].texture_ != sprites_[start].texture_)
+
+        // У следующего спрайта другое состояние рендеринга.
+        if (sprites_[nextSpriteIndex].state_ != sprites_[start].state_)
             break;
 
+        // У следующего спрайта другая текстура. Если она уже есть в порции или для нее есть
+        // свободный текстурный юнит, то спрайт все равно попадает в порцию.
+        Texture2D* texture = sprites_[nextSpriteIndex].texture_;
+        if (texture != sprites_[nextSpriteIndex - 1].texture_)
+        {
+            // При инстансинге примитивы выводятся отдельными порциями без инстансинга.
+            if (instancing && (texture == whiteTexture_) != (portionTextures_[0] == whiteTexture_))
+                break;
+
+            bool found = false;
+            for (unsigned i = 0; i < numPortionTextures_; i++)
+            {
+                if (portionTextures_[i] == texture)
+                {
+                    found = true;
+                    break;
+                }
+            }
+
+            if (!found)
+            {
+                if (numPortionTextures_ == maxTextures)
+                    break;
+
+                portionTextures_[numPortionTextures_++] = texture;
+            }
+        }
+
         // Все проверки пройдены, следующий спрайт тоже принадлежит текущей порции.
         count++;
     }
@@ -173,21 +1469,14 @@ unsigned SpriteBatch::GetPortionLength(unsigned start)
     return count;
 }
 
-void SpriteBatch::RenderPortion(unsigned start, unsigned count)
+void SpriteBatch::WriteVerticesScalar(SBVertex* vertices, const SBSprite* sprites, unsigned count,
+    float invTextureW, float invTextureH, float uOffset/* = 0.0f*/)
 {
-    // Текстура для данной порции спрайтов.
-    Texture2D* texture = sprites_[start].texture_;
-    float w = (float)texture->GetWidth();
-    float h = (float)texture->GetHeight();
-
-    // Начинаем заполнение вершинного буфера.
-    SBVertex* vertices = (SBVertex*)vertexBuffer_->Lock(0, count * VERTICES_PER_SPRITE, true);
-    
     // Цикл для всех спрайтов порции.
     for (unsigned i = 0; i < count; i++)
     {
         // Очередной спрайт.
-        SBSprite* sprite = sprites_.Buffer() + start + i;
+        const SBSprite* sprite = sprites + i;
 
         // Для краткости.
         unsigned color = sprite->color_.ToUInt();
@@ -195,18 +1484,34 @@ void SpriteBatch::RenderPortion(unsigned start, unsigned count)
         Vector2 origin = sprite->origin_;
         float scale    = sprite->scale_;
         float rotation = sprite->rotation_;
+        float depth    = sprite->layerDepth_; // Координата Z вершин (используется в режиме SORT_LAYERED).
+
+        // Размеры спрайта совпадают с размерами выводимой части текстуры.
+        const IntRect& rect = sprite->sourceRect_;
+        float w = (float)rect.Width();
+        float h = (float)rect.Height();
 
+        if (sprite->transform_)
+        {
+            // Трансформация уже вычислена, синус и косинус не нужны.
+            const SBTransform& t = *sprite->transform_;
+            vertices[i * VERTICES_PER_SPRITE + 0].SetPosition(t.m02_,                          t.m12_,                          depth);
+            vertices[i * VERTICES_PER_SPRITE + 1].SetPosition(t.m00_ * w + t.m02_,             t.m10_ * w + t.m12_,             depth);
+            vertices[i * VERTICES_PER_SPRITE + 2].SetPosition(t.m00_ * w + t.m01_ * h + t.m02_ + t.m03_ * w * h,
+                                                              t.m10_ * w + t.m11_ * h + t.m12_ + t.m13_ * w * h, depth);
+            vertices[i * VERTICES_PER_SPRITE + 3].SetPosition(t.m01_ * h + t.m02_,             t.m11_ * h + t.m12_,             depth);
+        }
         // Если спрайт не повернут, то прорисовка очень проста.
-        if (rotation == 0.0f && scale == 1.0f)
+        else if (rotation == 0.0f && scale == 1.0f)
         {
             // Сдвигаем спрайт на -origin.
             pos -= origin;
 
             // Лицевая грань задается по часовой стрелке. Учитываем, что ось Y направлена вниз.
-            vertices[i * VERTICES_PER_SPRITE + 0].position_ = Vector3(pos.x_,     pos.y_,     0.0f);
-            vertices[i * VERTICES_PER_SPRITE + 1].position_ = Vector3(pos.x_ + w, pos.y_,     0.0f);
-            vertices[i * VERTICES_PER_SPRITE + 2].position_ = Vector3(pos.x_ + w, pos.y_ + h, 0.0f);
-            vertices[i * VERTICES_PER_SPRITE + 3].position_ = Vector3(pos.x_,     pos.y_ + h, 0.0f);
+            vertices[i * VERTICES_PER_SPRITE + 0].SetPosition(pos.x_,     pos.y_,     depth);
+            vertices[i * VERTICES_PER_SPRITE + 1].SetPosition(pos.x_ + w, pos.y_,     depth);
+            vertices[i * VERTICES_PER_SPRITE + 2].SetPosition(pos.x_ + w, pos.y_ + h, depth);
+            vertices[i * VERTICES_PER_SPRITE + 3].SetPosition(pos.x_,     pos.y_ + h, depth);
         }
         else
         {
@@ -232,7 +1537,7 @@ void SpriteBatch::RenderPortion(unsigned start, unsigned count)
             // а у нас ось Y направлена вниз, то происходит вращение по часовой стрелке.
 
             float sin, cos;
-            SinCos(rotation, sin, cos);
+            SpriteSinCos(rotation, sin, cos);
 
             Matrix3 transform
             {
@@ -242,24 +1547,19 @@ void SpriteBatch::RenderPortion(unsigned start, unsigned count)
             };
             
             v0 = transform * v0;
-            // У нас 2D-координаты хранятся в 3D-векторе. И в атрибут вершины как раз нужно
-            // записать 3D-вектор. Поэтому можно не копировать координаты в новый вектор,
-            // а просто установить нужное значение глубины (1.0f меняется на 0.0f).
-            v0.z_ = 0.0f;
-            vertices[i * VERTICES_PER_SPRITE + 0].position_ = v0;
+            // У нас 2D-координаты хранятся в 3D-векторе, третья компонента которого - однородная координата.
+            // В вершину записываются только x и y, а глубина берется из спрайта.
+            vertices[i * VERTICES_PER_SPRITE + 0].SetPosition(v0.x_, v0.y_, depth);
 
             // То же самое для других вершин.
             v1 = transform * v1;
-            v1.z_ = 0.0f;
-            vertices[i * VERTICES_PER_SPRITE + 1].position_ = v1;
+            vertices[i * VERTICES_PER_SPRITE + 1].SetPosition(v1.x_, v1.y_, depth);
 
             v2 = transform * v2;
-            v2.z_ = 0.0f;
-            vertices[i * VERTICES_PER_SPRITE + 2].position_ = v2;
+            vertices[i * VERTICES_PER_SPRITE + 2].SetPosition(v2.x_, v2.y_, depth);
 
             v3 = transform * v3;
-            v3.z_ = 0.0f;
-            vertices[i * VERTICES_PER_SPRITE + 3].position_ = v3;
+            vertices[i * VERTICES_PER_SPRITE + 3].SetPosition(v3.x_, v3.y_, depth);
         }
 
         // Цвет вершин.
@@ -269,14 +1569,464 @@ void SpriteBatch::RenderPortion(unsigned start, unsigned count)
         vertices[i * VERTICES_PER_SPRITE + 3].color_ = color;
 
         // Текстурные координаты.
-        vertices[i * VERTICES_PER_SPRITE + 0].uv_ = Vector2(0.0f, 0.0f);
-        vertices[i * VERTICES_PER_SPRITE + 1].uv_ = Vector2(1.0f, 0.0f);
-        vertices[i * VERTICES_PER_SPRITE + 2].uv_ = Vector2(1.0f, 1.0f);
-        vertices[i * VERTICES_PER_SPRITE + 3].uv_ = Vector2(0.0f, 1.0f);
+        float left   = rect.left_   * invTextureW + uOffset;
+        float top    = rect.top_    * invTextureH;
+        float right  = rect.right_  * invTextureW + uOffset;
+        float bottom = rect.bottom_ * invTextureH;
+        vertices[i * VERTICES_PER_SPRITE + 0].uv_ = Vector2(left,  top);
+        vertices[i * VERTICES_PER_SPRITE + 1].uv_ = Vector2(right, top);
+        vertices[i * VERTICES_PER_SPRITE + 2].uv_ = Vector2(right, bottom);
+        vertices[i * VERTICES_PER_SPRITE + 3].uv_ = Vector2(left,  bottom);
+    }
+}
+
+#ifdef URHO3D_SSE
+// Записывает вершину в память, минуя кэш процессора (non-temporal store). Вершины только записываются
+// и больше процессором не читаются, поэтому нет смысла вытеснять ими из кэша полезные данные.
+// Вершина записывается по 4 байта, так как адрес заблокированного буфера не обязательно выровнен на 16 байт.
+static inline void StreamVertex(SBVertex* dest, const SBVertex& src)
+{
+    const int* source = (const int*)&src;
+    int* destination = (int*)dest;
+    for (unsigned i = 0; i < sizeof(SBVertex) / sizeof(int); i++)
+        _mm_stream_si32(destination + i, source[i]);
+}
+
+void SpriteBatch::WriteVerticesSSE(SBVertex* vertices, const SBSprite* sprites, unsigned count,
+    float invTextureW, float invTextureH, float uOffset/* = 0.0f*/)
+{
+    // Обрабатываем спрайты четверками: каждый SSE-регистр содержит одну и ту же величину для четырех спрайтов.
+    // Перед вычислениями данные четверки спрайтов переписываются в отдельные массивы (структура массивов, SoA),
+    // тогда как в sprites_ данные каждого спрайта хранятся вместе (массив структур, AoS).
+    unsigned simdCount = count & ~3u;
+
+    for (unsigned i = 0; i < simdCount; i += 4)
+    {
+        // Выравнивание на 16 байт нужно для _mm_load_ps() и _mm_store_ps().
+        // Для каждого спрайта используется матрица 2x2 (m00, m01, m10, m11) и сдвиг (posX, posY).
+        alignas(16) float posX[4], posY[4], originX[4], originY[4], width[4], height[4];
+        alignas(16) float m00[4], m01[4], m10[4], m11[4];
+
+        // Слагаемые m03 * w * h и m13 * w * h для правого нижнего угла (ненулевые только у примитивов).
+        alignas(16) float cross03[4], cross13[4];
+
+        for (unsigned lane = 0; lane < 4; lane++)
+        {
+            const SBSprite* sprite = sprites + i + lane;
+            width[lane] = (float)sprite->sourceRect_.Width();
+            height[lane] = (float)sprite->sourceRect_.Height();
+
+            if (sprite->transform_)
+            {
+                // Заранее вычисленная трансформация уже включает сдвиг на -origin.
+                const SBTransform& t = *sprite->transform_;
+                posX[lane] = t.m02_;
+                posY[lane] = t.m12_;
+                originX[lane] = 0.0f;
+                originY[lane] = 0.0f;
+                m00[lane] = t.m00_;
+                m01[lane] = t.m01_;
+                m10[lane] = t.m10_;
+                m11[lane] = t.m11_;
+                cross03[lane] = t.m03_ * width[lane] * height[lane];
+                cross13[lane] = t.m13_ * width[lane] * height[lane];
+                continue;
+            }
+
+            posX[lane] = sprite->position_.x_;
+            posY[lane] = sprite->position_.y_;
+            originX[lane] = sprite->origin_.x_;
+            originY[lane] = sprite->origin_.y_;
+            cross03[lane] = 0.0f;
+            cross13[lane] = 0.0f;
+
+            // Для неповернутых спрайтов синус равен нулю, а косинус единице. Для них формулы ниже
+            // дают тот же результат, что и простая ветка в WriteVerticesScalar().
+            float sin = 0.0f, cos = 1.0f;
+            if (sprite->rotation_ != 0.0f)
+                SpriteSinCos(sprite->rotation_, sin, cos);
+
+            m00[lane] = cos * sprite->scale_;
+            m01[lane] = -sin * sprite->scale_;
+            m10[lane] = sin * sprite->scale_;
+            m11[lane] = cos * sprite->scale_;
+        }
+
+        __m128 px = _mm_load_ps(posX);
+        __m128 py = _mm_load_ps(posY);
+        __m128 a = _mm_load_ps(m00);
+        __m128 b = _mm_load_ps(m01);
+        __m128 c = _mm_load_ps(m10);
+        __m128 d = _mm_load_ps(m11);
+
+        // Координаты углов спрайта относительно origin: левая и правая границы, верхняя и нижняя.
+        __m128 left = _mm_sub_ps(_mm_setzero_ps(), _mm_load_ps(originX));
+        __m128 right = _mm_add_ps(left, _mm_load_ps(width));
+        __m128 top = _mm_sub_ps(_mm_setzero_ps(), _mm_load_ps(originY));
+        __m128 bottom = _mm_add_ps(top, _mm_load_ps(height));
+
+        // Та же матрица, что и в WriteVerticesScalar() (для повернутого спрайта m00 = m11 = cos*s, m10 = -m01 = sin*s):
+        // x' = x * m00 + y * m01 + dx
+        // y' = x * m10 + y * m11 + dy
+        __m128 leftX = _mm_mul_ps(left, a);
+        __m128 leftY = _mm_mul_ps(left, c);
+        __m128 rightX = _mm_mul_ps(right, a);
+        __m128 rightY = _mm_mul_ps(right, c);
+        __m128 topX = _mm_mul_ps(top, b);
+        __m128 topY = _mm_mul_ps(top, d);
+        __m128 bottomX = _mm_mul_ps(bottom, b);
+        __m128 bottomY = _mm_mul_ps(bottom, d);
+
+        // Индекс первый - номер угла спрайта, второй - номер спрайта в четверке.
+        alignas(16) float x[VERTICES_PER_SPRITE][4], y[VERTICES_PER_SPRITE][4];
+        _mm_store_ps(x[0], _mm_add_ps(px, _mm_add_ps(leftX, topX)));     // Верхний левый угол.
+        _mm_store_ps(y[0], _mm_add_ps(py, _mm_add_ps(leftY, topY)));
+        _mm_store_ps(x[1], _mm_add_ps(px, _mm_add_ps(rightX, topX)));    // Правый верхний угол.
+        _mm_store_ps(y[1], _mm_add_ps(py, _mm_add_ps(rightY, topY)));
+        _mm_store_ps(x[2], _mm_add_ps(px, _mm_add_ps(rightX, bottomX))); // Нижний правый угол.
+        _mm_store_ps(y[2], _mm_add_ps(py, _mm_add_ps(rightY, bottomY)));
+        _mm_store_ps(x[3], _mm_add_ps(px, _mm_add_ps(leftX, bottomX)));  // Левый нижний угол.
+        _mm_store_ps(y[3], _mm_add_ps(py, _mm_add_ps(leftY, bottomY)));
+
+        // Правый нижний угол четырехугольника, который не является параллелограммом.
+        _mm_store_ps(x[2], _mm_add_ps(_mm_load_ps(x[2]), _mm_load_ps(cross03)));
+        _mm_store_ps(y[2], _mm_add_ps(_mm_load_ps(y[2]), _mm_load_ps(cross13)));
+
+        // Собираем вершины и записываем их в буфер.
+        for (unsigned lane = 0; lane < 4; lane++)
+        {
+            const SBSprite* sprite = sprites + i + lane;
+            const IntRect& rect = sprite->sourceRect_;
+            unsigned color = sprite->color_.ToUInt();
+            float uvLeft   = rect.left_   * invTextureW + uOffset;
+            float uvTop    = rect.top_    * invTextureH;
+            float uvRight  = rect.right_  * invTextureW + uOffset;
+            float uvBottom = rect.bottom_ * invTextureH;
+            Vector2 uvs[VERTICES_PER_SPRITE] =
+            {
+                Vector2(uvLeft,  uvTop),
+                Vector2(uvRight, uvTop),
+                Vector2(uvRight, uvBottom),
+                Vector2(uvLeft,  uvBottom)
+            };
+
+            SBVertex* dest = vertices + (i + lane) * VERTICES_PER_SPRITE;
+            for (unsigned corner = 0; corner < VERTICES_PER_SPRITE; corner++)
+            {
+                SBVertex vertex;
+                vertex.SetPosition(x[corner][lane], y[corner][lane], sprite->layerDepth_);
+                vertex.color_ = color;
+                vertex.uv_ = uvs[corner];
+                StreamVertex(dest + corner, vertex);
+            }
+        }
+    }
+
+    // Non-temporal записи не упорядочены относительно обычных, поэтому дожидаемся их завершения
+    // до того, как буфер будет разблокирован.
+    _mm_sfence();
+
+    // Оставшиеся (меньше четырех) спрайты.
+    WriteVerticesScalar(vertices + simdCount * VERTICES_PER_SPRITE, sprites + simdCount, count - simdCount,
+                        invTextureW, invTextureH, uOffset);
+}
+#endif
+
+void SpriteBatch::WriteVertices(SBVertex* vertices, const SBSprite* sprites, unsigned count,
+    float invTextureW, float invTextureH, float uOffset/* = 0.0f*/)
+{
+#ifdef URHO3D_SSE
+    WriteVerticesSSE(vertices, sprites, count, invTextureW, invTextureH, uOffset);
+#else
+    WriteVerticesScalar(vertices, sprites, count, invTextureW, invTextureH, uOffset);
+#endif
+}
+
+void SpriteBatch::WriteVerticesWork(const WorkItem* item, unsigned threadIndex)
+{
+    const SBWriteTask* task = (const SBWriteTask*)item->aux_;
+    const SBSprite* start = (const SBSprite*)item->start_;
+    const SBSprite* end = (const SBSprite*)item->end_;
+
+    // Части порции записываются в непересекающиеся участки заблокированного буфера.
+    unsigned offset = (unsigned)(start - task->sprites_);
+    WriteVertices(task->vertices_ + offset * VERTICES_PER_SPRITE, start, (unsigned)(end - start),
+                  task->invTextureW_, task->invTextureH_, task->uOffset_);
+}
+
+void SpriteBatch::WritePortionVertices(SBVertex* vertices, unsigned start, unsigned count,
+    float invTextureW, float invTextureH, float uOffset)
+{
+    // Каждый спрайт обрабатывается независимо от остальных, поэтому большую порцию
+    // можно разделить на части и заполнять их одновременно в нескольких потоках.
+    unsigned numTasks = Min(workQueue_->GetNumThreads() + 1, count / MIN_SPRITES_PER_TASK);
+
+    if (numTasks <= 1)
+    {
+        WriteVertices(vertices, sprites_.Buffer() + start, count, invTextureW, invTextureH, uOffset);
+        return;
+    }
+
+    // Общие для всех частей данные. Задания завершатся до выхода из функции,
+    // поэтому структуру можно хранить в стеке.
+    SBWriteTask task { vertices, sprites_.Buffer() + start, invTextureW, invTextureH, uOffset };
+
+    unsigned spritesPerTask = count / numTasks;
+
+    for (unsigned i = 0; i < numTasks; i++)
+    {
+        // Последняя часть забирает остаток.
+        unsigned taskStart = start + i * spritesPerTask;
+        unsigned taskEnd = (i == numTasks - 1) ? start + count : taskStart + spritesPerTask;
+
+        SharedPtr<WorkItem> item = workQueue_->GetFreeItem();
+        item->priority_ = M_MAX_UNSIGNED;
+        item->workFunction_ = WriteVerticesWork;
+        item->start_ = sprites_.Buffer() + taskStart;
+        item->end_ = sprites_.Buffer() + taskEnd;
+        item->aux_ = &task;
+        workQueue_->AddWorkItem(item);
+    }
+
+    // Основной поток тоже участвует в работе и ждет, пока все части не будут заполнены.
+    workQueue_->Complete(M_MAX_UNSIGNED);
+}
+
+unsigned SpriteBatch::GetPortionTextureIndex(Texture2D* texture) const
+{
+    for (unsigned i = 0; i < numPortionTextures_; i++)
+    {
+        if (portionTextures_[i] == texture)
+            return i;
+    }
+
+    // Сюда не попадаем: GetPortionLength() включает в порцию только спрайты с текстурами из таблицы.
+    return 0;
+}
+
+void SpriteBatch::SetPortionTextures()
+{
+    SetTexture(portionTextures_[0]);
+
+    // Остальные текстуры порции занимают следующие по порядку текстурные юниты:
+    // TU_NORMAL, TU_SPECULAR и TU_EMISSIVE.
+    for (unsigned i = 1; i < numPortionTextures_; i++)
+        graphics_->SetTexture((TextureUnit)(TU_DIFFUSE + i), portionTextures_[i]);
+}
+
+void SpriteBatch::RenderPortion(unsigned start, unsigned count)
+{
+    URHO3D_PROFILE(RenderPortion);
+
+    // Порция не помещается в остаток кольцевого буфера - возвращаемся в начало.
+    // Только в этом случае старое содержимое буфера отбрасывается (discard). Драйвер выделит
+    // новый блок памяти, не дожидаясь, пока видеокарта закончит рисовать предыдущие порции.
+    bool discard = false;
+    if (bufferPosition_ + count > bufferSize_)
+    {
+        bufferPosition_ = 0;
+        discard = true;
+    }
+
+    // Начинаем заполнение вершинного буфера. Запись идет в ту часть буфера, которая
+    // еще не использовалась уже отправленными драв коллами, поэтому синхронизация с видеокартой не нужна.
+    SBVertex* vertices = (SBVertex*)vertexBuffer_->Lock(bufferPosition_ * VERTICES_PER_SPRITE,
+                                                        count * VERTICES_PER_SPRITE, discard);
+
+    // Порция может состоять из нескольких участков с разными текстурами (если включен режим
+    // нескольких текстур). Участки заполняются по отдельности, так как размеры текстур у них разные.
+    unsigned runStart = start;
+    while (runStart != start + count)
+    {
+        Texture2D* texture = sprites_[runStart].texture_;
+
+        // Спрайты участка все равно перебираются, поэтому здесь же выбираются кадры анимаций
+        // (и только у тех спрайтов, которые действительно выводятся).
+        SelectAnimationFrame(sprites_[runStart]);
+
+        unsigned runEnd = runStart + 1;
+        while (runEnd != start + count && sprites_[runEnd].texture_ == texture)
+            SelectAnimationFrame(sprites_[runEnd++]);
+
+        // Множители для перевода пикселей текстуры в текстурные координаты.
+        float invTextureW = 1.0f / texture->GetWidth();
+        float invTextureH = 1.0f / texture->GetHeight();
+
+        // Номер текстуры передается в шейдер через сдвиг текстурной координаты u на 2 * номер.
+        float uOffset = 2.0f * GetPortionTextureIndex(texture);
+
+        WritePortionVertices(vertices + (runStart - start) * VERTICES_PER_SPRITE, runStart, runEnd - runStart,
+                             invTextureW, invTextureH, uOffset);
+
+        runStart = runEnd;
     }
 
     vertexBuffer_->Unlock();
-    
-    graphics_->SetTexture(TU_DIFFUSE, texture);
-    graphics_->Draw(TRIANGLE_LIST, 0, count * INDICES_PER_SPRITE, 0, count * VERTICES_PER_SPRITE);
+
+    SetPortionTextures();
+    graphics_->Draw(TRIANGLE_LIST, bufferPosition_ * INDICES_PER_SPRITE, count * INDICES_PER_SPRITE,
+                    bufferPosition_ * VERTICES_PER_SPRITE, count * VERTICES_PER_SPRITE);
+
+    stats_.numDrawCalls_++;
+    stats_.bytesUploaded_ += count * VERTICES_PER_SPRITE * sizeof(SBVertex);
+
+    // Следующая порция будет записана после текущей.
+    bufferPosition_ += count;
+}
+
+void SpriteBatch::RenderPrimitivePortion(unsigned start, unsigned count)
+{
+    // Четырехугольник примитива нельзя описать записью экземпляра (позиция, угол и масштаб),
+    // поэтому порция выводится обычным способом со стандартными шейдерами.
+    graphics_->SetVertexBuffer(vertexBuffer_);
+    graphics_->SetIndexBuffer(indexBuffer_);
+
+    appliedState_ = M_MAX_UNSIGNED;
+    ApplyState(sprites_[start].state_, vs_, ps_);
+
+    RenderPortion(start, count);
+
+    // Возвращаем буферы и шейдеры инстансинга для следующих порций.
+    graphics_->SetIndexBuffer(quadIndexBuffer_);
+    appliedState_ = M_MAX_UNSIGNED;
+}
+
+void SpriteBatch::DrawImmediate(const SBSprite& sprite)
+{
+    // Текстура сменилась или заблокированный участок заполнен - рисуем то, что накопилось.
+    if (sprite.texture_ != immediateTexture_ || sprite.state_ != immediateState_ || immediateCount_ == immediateCapacity_)
+        FlushImmediate();
+
+    if (!immediateVertices_)
+    {
+        // Участок кольцевого буфера блокируется так же, как в RenderPortion().
+        immediateCapacity_ = Min((unsigned)IMMEDIATE_LOCK_SIZE, maxPortionSize_);
+
+        bool discard = false;
+        if (bufferPosition_ + immediateCapacity_ > bufferSize_)
+        {
+            bufferPosition_ = 0;
+            discard = true;
+        }
+
+        immediateVertices_ = (SBVertex*)vertexBuffer_->Lock(bufferPosition_ * VERTICES_PER_SPRITE,
+                                                            immediateCapacity_ * VERTICES_PER_SPRITE, discard);
+        immediateCount_ = 0;
+        immediateTexture_ = sprite.texture_;
+        immediateState_ = sprite.state_;
+        immediateInvTextureW_ = 1.0f / immediateTexture_->GetWidth();
+        immediateInvTextureH_ = 1.0f / immediateTexture_->GetHeight();
+    }
+
+    // Для одного спрайта SIMD-версия не дает выигрыша.
+    SBSprite current = sprite;
+    SelectAnimationFrame(current);
+    WriteVerticesScalar(immediateVertices_ + immediateCount_ * VERTICES_PER_SPRITE, &current, 1,
+                        immediateInvTextureW_, immediateInvTextureH_);
+    immediateCount_++;
+}
+
+void SpriteBatch::FlushImmediate()
+{
+    if (!immediateVertices_)
+        return;
+
+    HiresTimer timer;
+
+    vertexBuffer_->Unlock();
+    immediateVertices_ = nullptr;
+
+    // Буферы достаточно установить один раз за пару Begin() / End().
+    if (appliedState_ == M_MAX_UNSIGNED)
+    {
+        SetTarget();
+        graphics_->SetVertexBuffer(vertexBuffer_);
+        graphics_->SetIndexBuffer(indexBuffer_);
+    }
+
+    ApplyState(immediateState_, vs_, ps_);
+
+    SetTexture(immediateTexture_);
+    graphics_->Draw(TRIANGLE_LIST, bufferPosition_ * INDICES_PER_SPRITE, immediateCount_ * INDICES_PER_SPRITE,
+                    bufferPosition_ * VERTICES_PER_SPRITE, immediateCount_ * VERTICES_PER_SPRITE);
+
+    stats_.numSprites_ += immediateCount_;
+    stats_.numDrawCalls_++;
+    stats_.bytesUploaded_ += immediateCount_ * VERTICES_PER_SPRITE * sizeof(SBVertex);
+
+    // Незаполненная часть участка не использовалась, следующая порция будет записана сразу после этой.
+    bufferPosition_ += immediateCount_;
+    immediateCount_ = 0;
+
+    stats_.endTime_ += timer.GetUSec(false);
+}
+
+void SpriteBatch::RenderPortionInstanced(unsigned start, unsigned count)
+{
+    URHO3D_PROFILE(RenderPortionInstanced);
+
+    // Буфер экземпляров кольцевой, так же как и вершинный буфер в RenderPortion().
+    bool discard = false;
+    if (instancePosition_ + count > bufferSize_)
+    {
+        instancePosition_ = 0;
+        discard = true;
+    }
+
+    SBInstance* instances = (SBInstance*)instanceBuffer_->Lock(instancePosition_, count, discard);
+
+    Texture2D* texture = nullptr;
+    float invTextureW = 0.0f;
+    float invTextureH = 0.0f;
+    float uOffset = 0.0f;
+
+    // Здесь нет никаких вычислений, данные спрайта просто копируются. Синус и косинус считаются в шейдере.
+    for (unsigned i = 0; i < count; i++)
+    {
+        SBSprite* sprite = sprites_.Buffer() + start + i;
+        SelectAnimationFrame(*sprite);
+        const IntRect& rect = sprite->sourceRect_;
+
+        // Текстура меняется только в режиме нескольких текстур.
+        if (sprite->texture_ != texture)
+        {
+            texture = sprite->texture_;
+            invTextureW = 1.0f / texture->GetWidth();
+            invTextureH = 1.0f / texture->GetHeight();
+            uOffset = 2.0f * GetPortionTextureIndex(texture);
+        }
+
+        if (sprite->transform_)
+        {
+            // Шейдер принимает угол и масштаб, поэтому из трансформации извлекаются они (перемещение и origin
+            // уже учтены в m02 и m12). Неравномерный масштаб и скос так передать нельзя.
+            const SBTransform& t = *sprite->transform_;
+            instances[i].positionOrigin_ = Vector4(t.m02_, t.m12_, 0.0f, 0.0f);
+            instances[i].sizeRotationScale_ = Vector4((float)rect.Width(), (float)rect.Height(),
+                                                      Atan2(t.m10_, t.m00_) * M_DEGTORAD, Vector2(t.m00_, t.m10_).Length());
+        }
+        else
+        {
+            instances[i].positionOrigin_ = Vector4(sprite->position_.x_, sprite->position_.y_,
+                                                   sprite->origin_.x_, sprite->origin_.y_);
+            instances[i].sizeRotationScale_ = Vector4((float)rect.Width(), (float)rect.Height(),
+                                                      sprite->rotation_ * M_DEGTORAD, sprite->scale_);
+        }
+        instances[i].uvRect_ = Vector4(rect.left_ * invTextureW + uOffset, rect.top_ * invTextureH,
+                                       rect.right_ * invTextureW + uOffset, rect.bottom_ * invTextureH);
+        instances[i].color_ = sprite->color_.ToUInt();
+    }
+
+    instanceBuffer_->Unlock();
+
+    // Смещение instancePosition_ указывает, с какой записи буфера экземпляров начинается порция.
+    graphics_->SetVertexBuffers(instancingBuffers_, instancePosition_);
+
+    SetPortionTextures();
+    graphics_->DrawInstanced(TRIANGLE_LIST, 0, INDICES_PER_SPRITE, 0, VERTICES_PER_SPRITE, count);
+
+    stats_.numDrawCalls_++;
+    stats_.bytesUploaded_ += count * sizeof(SBInstance);
+
+    instancePosition_ += count;
 }
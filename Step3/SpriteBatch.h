@@ -6,29 +6,145 @@
 
 #include <Urho3D/Urho3DAll.h>
 
+// Спрайт состоит из двух треугольников, а значит у него 6 вершин.
+// То есть каждый спрайт занимает 6 элементов в индексном буфере.
+#define INDICES_PER_SPRITE 6
+
+// Две вершины спрайта идентичны для обоих треугольников, поэтому
+// в вершинном буфере каждый спрайт занимает 4 элемента.
+#define VERTICES_PER_SPRITE 4
+
+// Порядок, в котором спрайты выводятся на экран (аналог SpriteSortMode из XNA).
+enum SortMode
+{
+    // Спрайты выводятся в порядке вызова Draw(). Объединяются только подряд идущие спрайты
+    // с одинаковой текстурой.
+    SORT_DEFERRED = 0,
+
+    // Спрайты группируются по текстурам. Порядок вывода спрайтов с разными текстурами не гарантируется,
+    // зато число драв коллов равно числу текстур (если спрайты помещаются в одну порцию).
+    SORT_TEXTURE,
+
+    // Спрайты сортируются по глубине: сперва выводятся дальние (layerDepth = 1), потом ближние (layerDepth = 0).
+    SORT_BACKTOFRONT,
+
+    // Спрайты сортируются по глубине: сперва выводятся ближние, потом дальние.
+    SORT_FRONTTOBACK,
+
+    // Спрайты не накапливаются в очереди: Draw() сразу записывает вершины в вершинный буфер.
+    // Порция рисуется при смене текстуры или когда заблокированный участок буфера заполнен.
+    // Подходит для вызывающих, которые сами выводят спрайты в порядке текстур (текст, тайлы).
+    // Инстансинг в этом режиме не используется.
+    SORT_IMMEDIATE,
+
+    // Спрайты выводятся в два прохода с использованием буфера глубины. Сначала непрозрачные
+    // (состояние с BLEND_REPLACE) от ближних к дальним с записью глубины: закрытые ими пиксели дальних спрайтов
+    // отбрасываются видеокартой до выполнения пиксельного шейдера (early-Z). Затем остальные - от дальних к ближним
+    // с проверкой глубины, но без записи. Глубина спрайтов (layerDepth) записывается в координату Z вершин.
+    // При выводе в текстуру используется свой буфер глубины, который очищается в End(). При выводе на экран
+    // используется буфер глубины сцены: он очищается, только если включен SetClearDepth(), иначе спрайты
+    // проверяются на глубину вместе с уже нарисованной сценой. Инстансинг в этом режиме не используется,
+    // а с SB_COMPACT_VERTICES режим работает как SORT_BACKTOFRONT.
+    SORT_LAYERED
+};
+
+class SpriteLayer;
+class AsyncTexture;
+class SpriteAnimation;
+class SpriteEmitter;
+
+// Статистика SpriteBatch за кадр.
+struct SpriteBatchStats
+{
+    unsigned numSprites_;         // Выведено спрайтов (без учета отброшенных).
+    unsigned numCulled_;          // Отброшено невидимых спрайтов.
+    unsigned numDrawCalls_;       // Вызовов Graphics::Draw() и Graphics::DrawInstanced().
+    unsigned numTextureSwitches_; // Смен текстуры между порциями.
+    unsigned bytesUploaded_;      // Передано данных в видеокарту.
+    long long endTime_;           // Время, проведенное в End(), RenderLayer() и RenderEmitter() (в микросекундах).
+                                  // В режиме SORT_IMMEDIATE учитывается вывод порций, но не запись вершин
+                                  // в Draw(): замер на каждый спрайт стоил бы дороже самой записи.
+};
+
+// Раскомментируйте, чтобы использовать компактный формат вершин. В нем не хранится координата Z,
+// которая у спрайтов всегда равна нулю, и вершина занимает 20 байт вместо 24. Это уменьшает объем данных,
+// передаваемых в видеокарту каждый кадр. Менять шейдер не нужно: недостающие компоненты позиции
+// видеокарта заполняет сама (z = 0, w = 1).
+// Форматов с 16-битными компонентами (для текстурных координат) в этой версии движка нет.
+//#define SB_COMPACT_VERTICES
+
+// Атрибуты вершин.
+struct SBVertex
+{
+#ifdef SB_COMPACT_VERTICES
+    Vector2 position_;
+#else
+    Vector3 position_;
+#endif
+    unsigned color_;
+    Vector2 uv_;
+
+    // Позволяет заполнять вершины одинаково для обоих форматов.
+    void SetPosition(float x, float y, float z)
+    {
+#ifdef SB_COMPACT_VERTICES
+        position_ = Vector2(x, y);
+#else
+        position_ = Vector3(x, y, z);
+#endif
+    }
+};
+
+// Раскомментируйте, чтобы синусы и косинусы углов поворота спрайтов брались из таблицы
+// (SpriteBatch::TableSinCos()), а не вычислялись. Угол округляется до 360 / SB_ROTATION_TABLE_SIZE градусов,
+// то есть угол спрайта размером 256 пикселей ошибается не больше чем на пятую часть пикселя.
+// Сравнение скорости: Benchmarks/SinCosBenchmark.cpp.
+//#define SB_ROTATION_TABLE
+
+// Размер таблицы синусов (степень двойки).
+#define SB_ROTATION_TABLE_SIZE 4096
+
+// Заранее вычисленная трансформация спрайта (матрица 2x3). Переводит координаты внутри спрайта в пикселях
+// ((0, 0) - левый верхний угол выводимой части текстуры) в экранные координаты:
+// x' = m00 * x + m01 * y + m02 + m03 * x * y
+// y' = m10 * x + m11 * y + m12 + m13 * x * y
+// Если угол и масштаб спрайта меняются редко, трансформацию можно хранить и пересчитывать только при изменении,
+// и тогда при выводе спрайта вообще не вычисляются синус и косинус.
+// Слагаемые m03 и m13 обычно равны нулю. Они позволяют превратить спрайт в произвольный четырехугольник
+// (так рисуются многоугольники в FillPolygon()). В режиме инстансинга они не поддерживаются.
+struct SBTransform
+{
+    float m00_, m01_, m02_;
+    float m10_, m11_, m12_;
+    float m03_, m13_;
+
+    // Та же трансформация, которую SpriteBatch строит из параметров Draw().
+    static SBTransform FromSprite(const Vector2& position, float rotation = 0.0f,
+        const Vector2& origin = Vector2::ZERO, float scale = 1.0f);
+};
+
 class SpriteBatch : public Object
 {
     URHO3D_OBJECT(SpriteBatch, Object);
 
 public:
-    SpriteBatch(Context *context);
-    virtual ~SpriteBatch();
-
-    // Подготовка к пакетному выводу спрайтов.
-    void Begin();
-
-    // Создает спрайт с нужными экранными координатами.
-    void Draw(Texture2D* texture, const Vector2& position, const Color& color = Color::WHITE,
-        float rotation = 0.0f, const Vector2 &origin = Vector2::ZERO, float scale = 1.0f);
+    // Наибольший размер порции, при котором используются 16-ти битные индексы:
+    // номер последней вершины равен 16383 * 4 - 1 = 65531 < 65536.
+    static const unsigned MAX_SHORT_PORTION_SIZE = 16383;
 
-    // Отображает спрайты на экране.
-    void End();
+    // Наибольшее число текстур в одной порции в режиме нескольких текстур
+    // (TU_DIFFUSE, TU_NORMAL, TU_SPECULAR и TU_EMISSIVE).
+    static const unsigned MAX_BATCH_TEXTURES = 4;
 
-private:
-    // Отдельный спрайт в очереди на отрисовку.
+    // Отдельный спрайт в очереди на отрисовку. Структура открыта, чтобы спрайты можно было
+    // готовить заранее в собственных массивах и передавать в DrawBulk() целиком.
     struct SBSprite
     {
         Texture2D* texture_;
+
+        // Выводимая часть текстуры (в пикселях). Размер спрайта совпадает с размером этого прямоугольника.
+        IntRect sourceRect_;
+
         Vector2 position_;
         Color color_;
 
@@ -39,27 +155,506 @@ private:
         // При указании позиции спрайта подразумевается позиция на экране именно этой точки.
         // Вращение спрайта также происходит вокруг этой точки.
         Vector2 origin_;
-        
+
         float scale_;
+
+        // Глубина спрайта в диапазоне [0, 1]. 0 - передний план, 1 - задний.
+        float layerDepth_;
+
+        // Номер состояния рендеринга (смотрите GetRenderState()). 0 - состояние по умолчанию.
+        unsigned state_;
+
+        // Заранее вычисленная трансформация. Если задана, то position_, rotation_, origin_ и scale_ не используются.
+        // Трансформация хранится у вызывающего и должна существовать до вызова End().
+        const SBTransform* transform_;
+
+        // Анимация (nullptr - спрайт не анимирован). Кадр выбирается при рендеринге порции по времени,
+        // прошедшему с animationStart_, и записывается в sourceRect_. До этого sourceRect_ должен содержать
+        // любой кадр анимации (по нему спрайт отсекается). Анимация должна существовать до вызова End().
+        const SpriteAnimation* animation_;
+
+        // Время начала анимации (по Time::GetElapsedTime()).
+        float animationStart_;
     };
 
+    // maxPortionSize - максимальное число спрайтов, выводимых за один драв колл. Если задать
+    // больше MAX_SHORT_PORTION_SIZE, то будет использоваться индексный буфер с 32-битными индексами.
+    SpriteBatch(Context *context, unsigned maxPortionSize = MAX_SHORT_PORTION_SIZE);
+    virtual ~SpriteBatch();
+
+    // Подготовка к пакетному выводу спрайтов.
+    void Begin(SortMode sortMode = SORT_DEFERRED);
+
+    // Спрайты выводятся не на экран, а в текстуру (созданную с TEXTURE_RENDERTARGET). Координаты спрайтов
+    // задаются в пикселях текстуры. Так можно один раз нарисовать сложную, редко меняющуюся панель интерфейса,
+    // а потом каждый кадр выводить ее одним спрайтом. Если clearTarget = true, текстура в End() сначала
+    // очищается прозрачным цветом. После End() рендеринг снова идет на экран.
+    void Begin(SortMode sortMode, Texture2D* target, bool clearTarget = true);
+    void Begin(SortMode sortMode, RenderSurface* target, bool clearTarget = true);
+
+    // Создает спрайт с нужными экранными координатами.
+    // Глубина layerDepth учитывается только в режимах SORT_BACKTOFRONT и SORT_FRONTTOBACK.
+    void Draw(Texture2D* texture, const Vector2& position, const Color& color = Color::WHITE,
+        float rotation = 0.0f, const Vector2 &origin = Vector2::ZERO, float scale = 1.0f, float layerDepth = 0.0f);
+
+    // Выводит только часть текстуры sourceRect (в пикселях). Позволяет хранить множество изображений
+    // в одной текстуре (атласе), и тогда все они выводятся за один драв колл.
+    void Draw(Texture2D* texture, const IntRect& sourceRect, const Vector2& position, const Color& color = Color::WHITE,
+        float rotation = 0.0f, const Vector2 &origin = Vector2::ZERO, float scale = 1.0f, float layerDepth = 0.0f);
+
+    // Выводит спрайт из атласа. Атлас (SpriteSheet2D) сопоставляет именам спрайтов прямоугольники в общей текстуре:
+    // spriteBatch->Draw(sheet->GetSprite("Ball"), ...). Точка привязки спрайта (hot spot) не используется,
+    // вместо нее указывается origin.
+    void Draw(Sprite2D* sprite, const Vector2& position, const Color& color = Color::WHITE,
+        float rotation = 0.0f, const Vector2 &origin = Vector2::ZERO, float scale = 1.0f, float layerDepth = 0.0f);
+
+    // Выводит текстуру, которая загружается в фоновом потоке (см. AsyncTexture). Пока текстура не загружена,
+    // вместо нее выводится текстура-заглушка (SetPlaceholderTexture()) своего размера, а если заглушки нет,
+    // спрайт пропускается. Draw() не ждет загрузки, поэтому кадр не задерживается.
+    void Draw(AsyncTexture* texture, const Vector2& position, const Color& color = Color::WHITE,
+        float rotation = 0.0f, const Vector2 &origin = Vector2::ZERO, float scale = 1.0f, float layerDepth = 0.0f);
+
+    // То же для части текстуры. Заглушка выводится в прямоугольнике sourceRect, поэтому она должна быть
+    // не меньше атласа или использовать адресацию ADDRESS_WRAP.
+    void Draw(AsyncTexture* texture, const IntRect& sourceRect, const Vector2& position,
+        const Color& color = Color::WHITE, float rotation = 0.0f, const Vector2 &origin = Vector2::ZERO,
+        float scale = 1.0f, float layerDepth = 0.0f);
+
+    // Выводит анимированный спрайт. startTime - момент начала анимации (по Time::GetElapsedTime()),
+    // разные значения позволяют анимациям одинаковых спрайтов не совпадать. Кадр выбирается в End(),
+    // так что игре не нужно ничего обновлять: достаточно каждый кадр выводить спрайт (или передавать
+    // подготовленный массив спрайтов в DrawBulk()). Время берется из Time в Begin().
+    // Анимации без кадров или без текстуры не выводятся. В SpriteLayer анимации не поддерживаются.
+    void Draw(const SpriteAnimation* animation, float startTime, const Vector2& position,
+        const Color& color = Color::WHITE, float rotation = 0.0f, const Vector2 &origin = Vector2::ZERO,
+        float scale = 1.0f, float layerDepth = 0.0f);
+
+    // Выводит спрайт с заранее вычисленной трансформацией. Указатель сохраняется в спрайте, так что
+    // трансформация должна существовать до вызова End(). В режиме инстансинга поддерживаются только
+    // трансформации из поворота, равномерного масштаба и перемещения.
+    void Draw(Texture2D* texture, const IntRect& sourceRect, const SBTransform* transform,
+        const Color& color = Color::WHITE, float layerDepth = 0.0f);
+
+    // Выводит строку шрифтом font размера fontSize. Каждый символ - отдельный спрайт из текстуры шрифта,
+    // поэтому весь текст одного шрифта выводится за несколько драв коллов. Строки разделяются символом '\n'.
+    // Позиция, поворот, начало координат и масштаб относятся ко всей строке (начало координат - левый верхний
+    // угол первой строки). Раскладка символов запоминается и не вычисляется заново, пока строка выводится каждый кадр.
+    void DrawString(Font* font, float fontSize, const String& text, const Vector2& position,
+        const Color& color = Color::WHITE, float rotation = 0.0f, const Vector2 &origin = Vector2::ZERO,
+        float scale = 1.0f, float layerDepth = 0.0f);
+
+    // Размер строки в пикселях (без учета масштаба).
+    Vector2 MeasureString(Font* font, float fontSize, const String& text);
+
+    // Примитивы: линии, прямоугольники и выпуклые многоугольники. Они выводятся как спрайты с белой текстурой
+    // размером 1x1 и попадают в тот же поток вершин, так что тысячи фигур рисуются за один драв колл
+    // (или за несколько, если между ними выводятся спрайты с другими текстурами).
+    // Координаты задаются в пикселях. Режим инстансинга на примитивы не распространяется.
+    void DrawLine(const Vector2& start, const Vector2& end, const Color& color = Color::WHITE,
+        float thickness = 1.0f, float layerDepth = 0.0f);
+
+    // Контур прямоугольника. Линии толщиной thickness лежат внутри прямоугольника.
+    void DrawRect(const Rect& rect, const Color& color = Color::WHITE, float thickness = 1.0f, float layerDepth = 0.0f);
+
+    void FillRect(const Rect& rect, const Color& color = Color::WHITE, float layerDepth = 0.0f);
+
+    // Многоугольник должен быть выпуклым. Вершины можно перечислять в любом направлении.
+    void FillPolygon(const Vector2* points, unsigned count, const Color& color = Color::WHITE, float layerDepth = 0.0f);
+
+    // Синус и косинус угла (в градусах) из таблицы размером SB_ROTATION_TABLE_SIZE.
+    static void TableSinCos(float angle, float& sin, float& cos);
+
+    // Добавляет сразу count спрайтов из массива (одним копированием памяти). Удобно, когда данные
+    // уже хранятся в непрерывном массиве (например, в системе частиц). Отсечение выполняется как в Draw().
+    // Состояние рендеринга берется из поля state_ каждого спрайта.
+    void DrawBulk(const SBSprite* sprites, unsigned count);
+
+    // Выделяет место под count спрайтов в конце очереди и возвращает указатель на первый из них.
+    // Вызывающий заполняет спрайты сам, без промежуточного массива и копирования. Такие спрайты
+    // не отсекаются. Указатель действителен только до следующего вызова Draw(), DrawBulk() или AllocateSprites().
+    // В режиме SORT_IMMEDIATE такие спрайты попадают в обычную очередь и выводятся в End() после остальных.
+    SBSprite* AllocateSprites(unsigned count);
+
+    // Добавление спрайтов из рабочих потоков WorkQueue (например, из заданий, обновляющих игровые объекты).
+    // threadIndex - номер потока, который передается в функцию задания (0 - основной поток). У каждого потока
+    // свой список спрайтов, поэтому блокировки не нужны. Списки объединяются в End() в порядке номеров потоков,
+    // после спрайтов, добавленных обычным Draw(). Вызывать можно только между Begin() и End(), состояние
+    // рендеринга (SetBlendMode() и т.п.) нельзя менять, пока работают задания.
+    // В режиме SORT_IMMEDIATE такие спрайты выводятся в End() после остальных.
+    void DrawFromThread(unsigned threadIndex, Texture2D* texture, const IntRect& sourceRect, const Vector2& position,
+        const Color& color = Color::WHITE, float rotation = 0.0f, const Vector2 &origin = Vector2::ZERO,
+        float scale = 1.0f, float layerDepth = 0.0f);
+    void DrawBulkFromThread(unsigned threadIndex, const SBSprite* sprites, unsigned count);
+
+    // Заранее выделяет память под numSprites спрайтов (для очереди и для сортировки).
+    // Память не освобождается между кадрами, так что при известном пиковом числе спрайтов
+    // в вызовах Draw() больше не будет перераспределений памяти.
+    void Reserve(unsigned numSprites);
+
+    // Отображает спрайты на экране.
+    void End();
+
+    // Состояние рендеринга для последующих вызовов Draw(). Позволяет выводить в одном SpriteBatch
+    // спрайты с разными режимами смешивания (например, аддитивные частицы поверх обычных спрайтов)
+    // и со своими шейдерами. Спрайты с разными состояниями не попадают в одну порцию, а в режиме SORT_TEXTURE
+    // группируются по состояниям, так что каждое состояние устанавливается один раз.
+    // Begin() сбрасывает состояние: BLEND_ALPHA, стандартные шейдеры, без области отсечения.
+    void SetBlendMode(BlendMode mode);
+
+    // Собственные шейдеры должны принимать тот же формат вершин, что и стандартные для текущего режима
+    // (обычные вершины или инстансинг). nullptr - стандартный шейдер.
+    void SetShaders(ShaderVariation* vs, ShaderVariation* ps);
+
+    // Область отсечения (scissor) в пикселях. IntRect::ZERO отключает отсечение.
+    void SetScissor(const IntRect& rect);
+
+    // Номер текущего состояния. Его нужно записывать в SBSprite::state_ при использовании
+    // DrawBulk() и AllocateSprites(). Номера действительны до следующего вызова Begin().
+    // Спрайты с недействительным номером выводятся в состоянии по умолчанию (с сообщением об ошибке).
+    unsigned GetRenderState() const { return currentState_; }
+
+    // Включает вывод спрайтов с помощью аппаратного инстансинга. В видеокарту передается не четыре вершины
+    // на спрайт, а одна компактная запись, и трансформация спрайта выполняется в вершинном шейдере.
+    // Если видеокарта не поддерживает инстансинг, режим не включится.
+    void SetInstancing(bool enable);
+    bool GetInstancing() const { return instancing_; }
+
+    // Включает режим нескольких текстур. В порцию попадают спрайты с разными текстурами (до MAX_BATCH_TEXTURES),
+    // каждая текстура устанавливается в свой текстурный юнит, а шейдер выбирает нужную по номеру,
+    // записанному в вершины. Вместе с SORT_TEXTURE число драв коллов уменьшается в несколько раз.
+    // В режиме SORT_IMMEDIATE и в RenderLayer() не используется.
+    void SetMultiTexture(bool enable) { multiTexture_ = enable; }
+    bool GetMultiTexture() const { return multiTexture_; }
+
+    // Очищать буфер глубины экрана в End() в режиме SORT_LAYERED (по умолчанию выключено). Очистка стирает
+    // глубину 3D-сцены, поэтому нужна, только если спрайты должны выводиться поверх нее без учета глубины сцены.
+    void SetClearDepth(bool enable) { clearDepth_ = enable; }
+    bool GetClearDepth() const { return clearDepth_; }
+
+    // Текстура, которая выводится вместо еще не загруженных AsyncTexture. По умолчанию не задана.
+    void SetPlaceholderTexture(Texture2D* texture) { placeholderTexture_ = texture; }
+    Texture2D* GetPlaceholderTexture() const { return placeholderTexture_; }
+
+    // Включает отсечение спрайтов, которые не попадают на экран (включено по умолчанию).
+    // Такие спрайты отбрасываются прямо в Draw() и не попадают в вершинный буфер.
+    void SetCulling(bool enable) { culling_ = enable; }
+    bool GetCulling() const { return culling_; }
+
+    // Область отсечения в пикселях. Если не задана (IntRect::ZERO), используется весь экран.
+    // Новое значение вступает в силу при следующем вызове Begin().
+    void SetCullRect(const IntRect& rect) { userCullRect_ = rect; }
+    const IntRect& GetCullRect() const { return userCullRect_; }
+
+    // Число спрайтов, отброшенных с момента последнего вызова Begin().
+    unsigned GetNumCulled() const { return numCulled_; }
+
+    // Статистика за предыдущий кадр. Если создан DebugHud, статистика также выводится в нем.
+    const SpriteBatchStats& GetStats() const { return lastFrameStats_; }
+
+    // Выводит статический слой спрайтов. Вершины слоя хранятся в видеопамяти и не пересчитываются каждый кадр.
+    // Вызывается вне пары Begin() / End(). Слой будет нарисован поверх всего, что было выведено до этого.
+    void RenderLayer(SpriteLayer* layer);
+
+    // Выводит частицы эмиттера одним драв коллом с инстансингом (частицы просчитываются в вершинном шейдере).
+    // Вызывается, как и RenderLayer(), вне пары Begin() / End(), и частицы будут нарисованы поверх всего,
+    // что было выведено до этого. Требует поддержки инстансинга, но сам режим SetInstancing() включать не нужно.
+    void RenderEmitter(SpriteEmitter* emitter);
+
+private:
+    // Слой использует те же структуры данных и функции заполнения буферов.
+    friend class SpriteLayer;
+
     // Индексный буфер создается и заполняется один раз, а потом только используется.
     SharedPtr<IndexBuffer> indexBuffer_;
 
     // Вершинный буфер перезаполняется каждый кадр.
     SharedPtr<VertexBuffer> vertexBuffer_;
 
+    // Максимальное число спрайтов в порции.
+    unsigned maxPortionSize_;
+
+    // Вместимость вершинного и индексного буферов (в спрайтах).
+    unsigned bufferSize_;
+
+    // Позиция в кольцевом вершинном буфере (в спрайтах), с которой будет записана следующая порция.
+    unsigned bufferPosition_;
+
     // Спрайты, которые ожидают рендеринга.
     PODVector<SBSprite> sprites_;
 
+    // Спрайты, добавленные из потоков WorkQueue (по списку на поток).
+    struct SBThreadBuffer
+    {
+        PODVector<SBSprite> sprites_;
+        unsigned numCulled_;
+
+        // Потоки постоянно меняют размер своих списков. Отступ не дает данным соседних списков
+        // оказаться в одной кэш-линии (иначе ядра процессора мешали бы друг другу).
+        unsigned char padding_[64];
+    };
+    Vector<SBThreadBuffer> threadBuffers_;
+
+    // Переносит спрайты из threadBuffers_ в sprites_.
+    void MergeThreadBuffers();
+
+    // Номера состояний спрайтов из DrawBulk(), AllocateSprites() и DrawBulkFromThread() задает вызывающий.
+    // Номер, который не существует в этом кадре (например, оставшийся с прошлого кадра), заменяется
+    // на состояние по умолчанию, чтобы не читать за пределами states_.
+    void ValidateSpriteStates();
+
+    // Текущий режим сортировки (задается в Begin()).
+    SortMode sortMode_;
+
+    // Вспомогательные массивы для сортировки. Хранятся в классе, чтобы не выделять память каждый кадр.
+    PODVector<SBSprite> sortedSprites_;
+    PODVector<unsigned> sortKeys_;
+    PODVector<unsigned> sortIndices_;
+    PODVector<unsigned> tempKeys_;
+    PODVector<unsigned> tempIndices_;
+
+    // Номера текстур для режима SORT_TEXTURE (в порядке первого появления текстуры в списке).
+    HashMap<Texture2D*, unsigned> textureIds_;
+
+    // Отсечение невидимых спрайтов.
+    bool culling_;
+    IntRect userCullRect_;
+    Rect cullRect_; // Область отсечения текущего кадра (вычисляется в Begin()).
+    unsigned numCulled_;
+
+    // Статистика текущего и предыдущего кадров.
+    SpriteBatchStats stats_;
+    SpriteBatchStats lastFrameStats_;
+
+    // Последняя установленная текстура (для подсчета смен текстур).
+    Texture2D* lastTexture_;
+
+    // В начале кадра сохраняет статистику предыдущего кадра и передает ее в DebugHud.
+    void HandleBeginFrame(StringHash eventType, VariantMap& eventData);
+
+    // Используется ли инстансинг.
+    bool instancing_;
+
+    // Буферы для инстансинга. Единичный квадрат, который в шейдере растягивается до размеров спрайта
+    // (он же используется для частиц), и кольцевой буфер экземпляров (одна запись на спрайт).
+    SharedPtr<VertexBuffer> quadVertexBuffer_;
+    SharedPtr<IndexBuffer> quadIndexBuffer_;
+    SharedPtr<VertexBuffer> instanceBuffer_;
+    PODVector<VertexBuffer*> instancingBuffers_; // Оба вершинных буфера вместе.
+    PODVector<VertexBuffer*> emitterBuffers_;    // Квадрат и буфер эмиттера (заполняется в RenderEmitter()).
+
+    // Создает единичный квадрат, если он еще не создан.
+    void CreateQuadBuffers();
+
+    // Позиция в кольцевом буфере экземпляров (в спрайтах).
+    unsigned instancePosition_;
+
+    // Состояние режима SORT_IMMEDIATE. Вершины пишутся прямо в заблокированный участок вершинного буфера.
+    SBVertex* immediateVertices_;   // Начало заблокированного участка (nullptr, если буфер не заблокирован).
+    unsigned immediateCapacity_;    // Размер заблокированного участка (в спрайтах).
+    unsigned immediateCount_;       // Сколько спрайтов уже записано.
+    Texture2D* immediateTexture_;   // Текстура текущей порции.
+    float immediateInvTextureW_;
+    float immediateInvTextureH_;
+    unsigned immediateState_;       // Состояние рендеринга текущей порции.
+
+    // Символ строки.
+    struct SBGlyph
+    {
+        Texture2D* texture_;  // Страница текстуры шрифта.
+        IntRect sourceRect_;  // Прямоугольник символа в текстуре.
+        Vector2 offset_;      // Положение символа относительно левого верхнего угла строки.
+    };
+
+    // Раскладка строки. Указатели на текстуры действительны, пока существует FontFace.
+    struct SBTextLayout
+    {
+        WeakPtr<FontFace> face_;
+        String text_;
+        PODVector<SBGlyph> glyphs_;
+        Vector2 size_;
+        bool used_; // Строка выводилась в текущем кадре.
+    };
+
+    // Раскладки строк. Ключ - хэш строки вместе с указателем на FontFace. При совпадении хэшей
+    // у разных строк раскладка просто пересчитывается. Не использованные за кадр раскладки удаляются
+    // в HandleBeginFrame(), так что меняющийся текст (например, счет) не накапливается.
+    HashMap<unsigned, SBTextLayout> textLayouts_;
+
+    // Возвращает раскладку строки, вычисляя ее при необходимости. nullptr, если у шрифта нет такого размера.
+    const SBTextLayout* GetTextLayout(Font* font, float fontSize, const String& text);
+
+    // Белая текстура 1x1 для примитивов. Ее текстурные координаты не важны: любая точка текстуры белая.
+    SharedPtr<Texture2D> whiteTexture_;
+
+    // Заглушка для незагруженных AsyncTexture.
+    SharedPtr<Texture2D> placeholderTexture_;
+
+    // Трансформации примитивов. Спрайты хранят указатели на них, поэтому память выделяется блоками,
+    // которые никогда не перемещаются. Блоки используются повторно после каждого Begin().
+    Vector<SharedArrayPtr<SBTransform> > primitiveBlocks_;
+    unsigned numPrimitives_;
+
+    // Добавляет четырехугольник с углами c0 - c3 (по часовой стрелке, начиная с левого верхнего угла).
+    void DrawQuad(const Vector2& c0, const Vector2& c1, const Vector2& c2, const Vector2& c3,
+        const Color& color, float layerDepth);
+
+    // Время кадра для выбора кадров анимаций (запоминается в Begin()).
+    float animationTime_;
+
+    // Записывает в sourceRect_ анимированного спрайта текущий кадр.
+    void SelectAnimationFrame(SBSprite& sprite) const;
+
+    // Состояние рендеринга, которое может меняться между спрайтами.
+    struct SBRenderState
+    {
+        BlendMode blendMode_;
+        ShaderVariation* vs_; // nullptr - стандартный шейдер.
+        ShaderVariation* ps_;
+        IntRect scissor_;     // IntRect::ZERO - без отсечения.
+
+        bool operator ==(const SBRenderState& rhs) const
+        {
+            return blendMode_ == rhs.blendMode_ && vs_ == rhs.vs_ && ps_ == rhs.ps_ && scissor_ == rhs.scissor_;
+        }
+    };
+
+    // Все состояния, использованные с момента вызова Begin(). Спрайты хранят номер состояния в этом массиве.
+    PODVector<SBRenderState> states_;
+
+    // Номер состояния для следующих спрайтов.
+    unsigned currentState_;
+
+    // Номер состояния, установленного в Graphics последним (M_MAX_UNSIGNED - еще не установлено).
+    unsigned appliedState_;
+
     // Кэширование часто используемых вещей.
     Graphics* graphics_;
+    WorkQueue* workQueue_;
     ShaderVariation* vs_; // Вершинный шейдер.
     ShaderVariation* ps_; // Пиксельный шейдер.
+    ShaderVariation* instancingVs_; // Шейдеры для инстансинга.
+    ShaderVariation* instancingPs_;
+    ShaderVariation* multiTextureVs_; // Шейдеры для режима нескольких текстур.
+    ShaderVariation* multiTexturePs_;
+    ShaderVariation* instancingMultiTextureVs_;
+    ShaderVariation* instancingMultiTexturePs_;
+    ShaderVariation* particleVs_; // Шейдеры частиц.
+    ShaderVariation* particlePs_;
+
+    // Режим нескольких текстур.
+    bool multiTexture_;
+
+    // Текстуры текущей порции (заполняются в GetPortionLength()).
+    Texture2D* portionTextures_[MAX_BATCH_TEXTURES];
+    unsigned numPortionTextures_;
+
+    // Задает размер и заполняет индексный буфер для spriteCount спрайтов.
+    // Если номера вершин не помещаются в 16 бит, то используются 32-битные индексы.
+    static void FillIndexBuffer(IndexBuffer* indexBuffer, unsigned spriteCount);
+
+    // Задает размер и формат вершинного буфера для spriteCount спрайтов.
+    static void SetVertexBufferSize(VertexBuffer* vertexBuffer, unsigned spriteCount, bool dynamic);
+
+    // Устанавливает режим смешивания и параметры шейдеров. Вызывается после SetShaders().
+    void SetRenderState();
+
+    // Матрица, переводящая пиксельные координаты в экранные. Пересчитывается только при изменении размеров
+    // области вывода. flipVertical - переворот изображения по вертикали (для вывода в текстуру в OpenGL).
+    // depth - переводить координату Z вершин в глубину (для режима SORT_LAYERED), иначе глубина равна нулю.
+    Matrix4 viewProjMatrix_;
+    IntVector2 projectionSize_;
+    bool projectionFlipped_;
+    bool projectionDepth_;
+    void UpdateViewProjMatrix(int width, int height, bool flipVertical, bool depth);
+
+    // Текстура, в которую выводятся спрайты (nullptr - экран).
+    RenderSurface* target_;
+    bool clearTarget_;
+
+    // Смотрите SetClearDepth().
+    bool clearDepth_;
+
+    // Установлена ли текстура в Graphics. Это происходит при выводе первой порции.
+    bool targetSet_;
+
+    // Устанавливает текстуру target_ (если она задана и еще не установлена).
+    void SetTarget();
 
-    // Определяет количество спрайтов, которые можно отрендерить без смены текстуры.
-    unsigned GetPortionLength(unsigned start);
+    // Сортирует и рендерит спрайты из очереди.
+    void RenderSprites();
 
-    // Рендерит порцию спрайтов, использующих одну и ту же текстуру.
+    // Делает текущим состояние, совпадающее с state (добавляет его в states_, если такого еще нет).
+    void SelectState(const SBRenderState& state);
+
+    // Устанавливает состояние с номером index, если оно еще не установлено. Если в состоянии не заданы
+    // шейдеры, используются defaultVs и defaultPs.
+    void ApplyState(unsigned index, ShaderVariation* defaultVs, ShaderVariation* defaultPs);
+
+    // Добавляет спрайт в очередь (или сразу в вершинный буфер в режиме SORT_IMMEDIATE), если он видим.
+    void AddSprite(const SBSprite& sprite);
+
+    // Проверяет, может ли спрайт попасть в область отсечения.
+    bool IsVisible(const SBSprite& sprite) const;
+
+    // Упорядочивает sprites_ в соответствии с sortMode_.
+    void SortSprites();
+
+    // Определяет количество спрайтов, которые можно отрендерить без смены текстуры (или без смены
+    // набора текстур в режиме нескольких текстур) и без смены состояния. Заполняет portionTextures_.
+    // instancing - используется ли инстансинг на самом деле (в режиме SORT_LAYERED он отключается).
+    unsigned GetPortionLength(unsigned start, bool instancing);
+
+    // Номер текстуры в portionTextures_.
+    unsigned GetPortionTextureIndex(Texture2D* texture) const;
+
+    // Устанавливает текстуры текущей порции.
+    void SetPortionTextures();
+
+    // Вычисляет вершины count спрайтов. invTextureW и invTextureH - величины, обратные размерам текстуры.
+    // uOffset прибавляется к текстурной координате u (так в шейдер передается номер текстуры).
+    // Если движок собран с поддержкой SSE, используется WriteVerticesSSE(), иначе WriteVerticesScalar().
+    static void WriteVertices(SBVertex* vertices, const SBSprite* sprites, unsigned count,
+        float invTextureW, float invTextureH, float uOffset = 0.0f);
+    static void WriteVerticesScalar(SBVertex* vertices, const SBSprite* sprites, unsigned count,
+        float invTextureW, float invTextureH, float uOffset = 0.0f);
+#ifdef URHO3D_SSE
+    static void WriteVerticesSSE(SBVertex* vertices, const SBSprite* sprites, unsigned count,
+        float invTextureW, float invTextureH, float uOffset = 0.0f);
+#endif
+
+    // Данные, общие для всех заданий, на которые делится большая порция при многопоточном заполнении.
+    struct SBWriteTask
+    {
+        SBVertex* vertices_;      // Заблокированный вершинный буфер порции.
+        const SBSprite* sprites_; // Первый спрайт порции.
+        float invTextureW_;
+        float invTextureH_;
+        float uOffset_;
+    };
+
+    // Выполняется в рабочем потоке. Заполняет вершины спрайтов из диапазона [item->start_, item->end_).
+    static void WriteVerticesWork(const WorkItem* item, unsigned threadIndex);
+
+    // Устанавливает текстуру порции и учитывает смену текстуры в статистике.
+    void SetTexture(Texture2D* texture);
+
+    // Записывает спрайт в вершинный буфер в режиме SORT_IMMEDIATE.
+    void DrawImmediate(const SBSprite& sprite);
+
+    // Разблокирует вершинный буфер и рисует накопленную в режиме SORT_IMMEDIATE порцию.
+    void FlushImmediate();
+
+    // Заполняет вершины спрайтов [start, start + count) с одной текстурой. Большие участки
+    // заполняются в нескольких потоках.
+    void WritePortionVertices(SBVertex* vertices, unsigned start, unsigned count,
+        float invTextureW, float invTextureH, float uOffset);
+
+    // Рендерит порцию спрайтов, использующих одну и ту же текстуру (или один набор текстур).
     void RenderPortion(unsigned start, unsigned count);
+
+    // То же самое, но с помощью инстансинга.
+    void RenderPortionInstanced(unsigned start, unsigned count);
+
+    // Выводит порцию примитивов без инстансинга, когда инстансинг включен.
+    void RenderPrimitivePortion(unsigned start, unsigned count);
 };
@@ -0,0 +1,90 @@
+﻿#include "SpriteEmitter.h"
+
+SpriteEmitter::SpriteEmitter(Context* context) : Object(context),
+    sourceRect_(IntRect::ZERO),
+    numParticles_(1000),
+    bufferDirty_(true),
+    position_(Vector2::ZERO),
+    lifetime_(2.0f),
+    direction_(-90.0f),
+    spread_(30.0f),
+    minSpeed_(50.0f),
+    maxSpeed_(150.0f),
+    gravity_(0.0f, 100.0f),
+    minSpin_(-180.0f),
+    maxSpin_(180.0f),
+    startScale_(1.0f),
+    endScale_(0.5f),
+    startColor_(Color::WHITE),
+    endColor_(Color::TRANSPARENT),
+    blendMode_(BLEND_ADDALPHA),
+    startTime_(0.0f),
+    duration_(0.0f)
+{
+    instanceBuffer_ = new VertexBuffer(context_);
+
+    // Теневая копия нужна для восстановления содержимого при потере устройства.
+    instanceBuffer_->SetShadowed(true);
+
+    Start();
+}
+
+SpriteEmitter::~SpriteEmitter()
+{
+}
+
+void SpriteEmitter::SetTexture(Texture2D* texture)
+{
+    SetTexture(texture, texture ? IntRect(0, 0, texture->GetWidth(), texture->GetHeight()) : IntRect::ZERO);
+}
+
+void SpriteEmitter::SetTexture(Texture2D* texture, const IntRect& sourceRect)
+{
+    texture_ = texture;
+    sourceRect_ = sourceRect;
+}
+
+void SpriteEmitter::SetNumParticles(unsigned numParticles)
+{
+    if (numParticles == numParticles_)
+        return;
+
+    numParticles_ = numParticles;
+    bufferDirty_ = true;
+}
+
+void SpriteEmitter::Start(float duration/* = 0.0f*/)
+{
+    startTime_ = GetSubsystem<Time>()->GetElapsedTime();
+    duration_ = Max(duration, 0.0f);
+}
+
+float SpriteEmitter::GetTime() const
+{
+    return GetSubsystem<Time>()->GetElapsedTime() - startTime_;
+}
+
+void SpriteEmitter::Update()
+{
+    if (!bufferDirty_)
+        return;
+
+    bufferDirty_ = false;
+
+    if (numParticles_ == 0)
+        return;
+
+    // Атрибут с флагом perInstance берется из буфера один раз на частицу. Шейдер получает его как iTexCoord4.
+    PODVector<VertexElement> elements;
+    elements.Push(VertexElement(TYPE_VECTOR4, SEM_TEXCOORD, 4, true));
+    instanceBuffer_->SetSize(numParticles_, elements);
+
+    // x - момент первого рождения частицы (в долях времени жизни). Моменты распределены равномерно
+    // со случайным сдвигом внутри своего интервала, чтобы частицы рождались с постоянной частотой,
+    // но не строем. yzw - случайные числа для направления, скорости и вращения.
+    PODVector<Vector4> seeds(numParticles_);
+    for (unsigned i = 0; i < numParticles_; i++)
+        seeds[i] = Vector4((i + Random(1.0f)) / numParticles_, Random(1.0f), Random(1.0f), Random(1.0f));
+
+    instanceBuffer_->SetData(seeds.Buffer());
+}
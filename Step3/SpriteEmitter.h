@@ -0,0 +1,126 @@
+﻿/*
+    Эмиттер частиц, которые просчитываются видеокартой. Состояние частиц не хранится и не обновляется
+    на CPU: в буфере экземпляров лежат только случайные числа частиц, которые заполняются один раз,
+    а положение, поворот, размер и цвет каждой частицы вершинный шейдер вычисляет по формулам
+    из времени, прошедшего с запуска эмиттера, и параметров эмиттера. Поэтому каждый кадр на CPU
+    выполняется работа только на эмиттер (установка параметров и один драв колл), а не на частицу.
+    Выводится эмиттер с помощью SpriteBatch::RenderEmitter().
+
+    Частица i рождается каждые lifetime секунд со сдвигом по времени, так что одновременно живут
+    все numParticles частиц, а в секунду рождается numParticles / lifetime частиц. При каждом рождении
+    частица получает новые направление, скорость и вращение.
+
+    Частицы движутся относительно эмиттера: если переместить эмиттер, переместятся и все живые частицы.
+*/
+
+#pragma once
+
+#include <Urho3D/Urho3DAll.h>
+
+class SpriteEmitter : public Object
+{
+    URHO3D_OBJECT(SpriteEmitter, Object);
+
+public:
+    // Эмиттер начинает испускать частицы сразу после создания.
+    SpriteEmitter(Context* context);
+    virtual ~SpriteEmitter();
+
+    // Текстура частиц (вся или ее часть sourceRect в пикселях). Размер частицы совпадает с размером
+    // выводимой части текстуры. Без текстуры эмиттер не выводится.
+    void SetTexture(Texture2D* texture);
+    void SetTexture(Texture2D* texture, const IntRect& sourceRect);
+
+    // Число одновременно живущих частиц.
+    void SetNumParticles(unsigned numParticles);
+
+    // Положение эмиттера на экране в пикселях.
+    void SetPosition(const Vector2& position) { position_ = position; }
+
+    // Время жизни частицы в секундах.
+    void SetLifetime(float lifetime) { lifetime_ = Max(lifetime, M_EPSILON); }
+
+    // Направление вылета (угол по часовой стрелке в градусах, 0 - вправо) и разброс в обе стороны от него.
+    void SetDirection(float direction, float spread) { direction_ = direction; spread_ = spread; }
+
+    // Диапазон начальной скорости в пикселях в секунду. Скорость каждой частицы выбирается в нем случайно.
+    void SetSpeed(float minSpeed, float maxSpeed) { minSpeed_ = minSpeed; maxSpeed_ = maxSpeed; }
+
+    // Постоянное ускорение в пикселях в секунду за секунду (ось Y направлена вниз).
+    void SetGravity(const Vector2& gravity) { gravity_ = gravity; }
+
+    // Диапазон скорости вращения в градусах в секунду.
+    void SetSpin(float minSpin, float maxSpin) { minSpin_ = minSpin; maxSpin_ = maxSpin; }
+
+    // Масштаб и цвет частицы в момент рождения и в конце жизни. Между ними значения интерполируются.
+    void SetScale(float startScale, float endScale) { startScale_ = startScale; endScale_ = endScale; }
+    void SetColors(const Color& startColor, const Color& endColor) { startColor_ = startColor; endColor_ = endColor; }
+
+    // По умолчанию BLEND_ADDALPHA: частицы не нужно сортировать, и там, где они перекрываются, изображение светлее.
+    void SetBlendMode(BlendMode mode) { blendMode_ = mode; }
+
+    // Запускает эмиттер заново. Частицы рождаются в течение duration секунд (0 - бесконечно),
+    // после чего последние из них доживают свой срок. Так можно сделать взрыв или вспышку.
+    void Start(float duration = 0.0f);
+
+    Texture2D* GetTexture() const { return texture_; }
+    const IntRect& GetSourceRect() const { return sourceRect_; }
+    unsigned GetNumParticles() const { return numParticles_; }
+    const Vector2& GetPosition() const { return position_; }
+    float GetLifetime() const { return lifetime_; }
+    float GetDirection() const { return direction_; }
+    float GetSpread() const { return spread_; }
+    float GetMinSpeed() const { return minSpeed_; }
+    float GetMaxSpeed() const { return maxSpeed_; }
+    const Vector2& GetGravity() const { return gravity_; }
+    float GetMinSpin() const { return minSpin_; }
+    float GetMaxSpin() const { return maxSpin_; }
+    float GetStartScale() const { return startScale_; }
+    float GetEndScale() const { return endScale_; }
+    const Color& GetStartColor() const { return startColor_; }
+    const Color& GetEndColor() const { return endColor_; }
+    BlendMode GetBlendMode() const { return blendMode_; }
+    float GetDuration() const { return duration_; }
+
+    // Время в секундах, прошедшее с запуска эмиттера.
+    float GetTime() const;
+
+    // Эмиттер с ограниченной длительностью больше не выводит ни одной частицы.
+    bool IsFinished() const { return duration_ > 0.0f && GetTime() > duration_ + lifetime_; }
+
+    // Заполняет буфер экземпляров, если изменилось число частиц. Вызывается автоматически
+    // в SpriteBatch::RenderEmitter().
+    void Update();
+
+    VertexBuffer* GetInstanceBuffer() const { return instanceBuffer_; }
+
+private:
+    SharedPtr<Texture2D> texture_;
+    IntRect sourceRect_;
+
+    unsigned numParticles_;
+
+    // Случайные числа частиц (по одному Vector4 на частицу). Буфер не динамический, так как
+    // заполняется только при изменении числа частиц.
+    SharedPtr<VertexBuffer> instanceBuffer_;
+    bool bufferDirty_;
+
+    Vector2 position_;
+    float lifetime_;
+    float direction_;
+    float spread_;
+    float minSpeed_;
+    float maxSpeed_;
+    Vector2 gravity_;
+    float minSpin_;
+    float maxSpin_;
+    float startScale_;
+    float endScale_;
+    Color startColor_;
+    Color endColor_;
+    BlendMode blendMode_;
+
+    // Время запуска (по Time::GetElapsedTime()) и длительность испускания частиц.
+    float startTime_;
+    float duration_;
+};
@@ -0,0 +1,159 @@
+﻿#include "SpriteLayer.h"
+
+SpriteLayer::SpriteLayer(Context* context) : Object(context),
+    capacity_(0),
+    dirtyStart_(M_MAX_UNSIGNED),
+    dirtyEnd_(0),
+    portionsDirty_(false)
+{
+    vertexBuffer_ = new VertexBuffer(context_);
+
+    // Теневая копия в памяти процессора позволяет обновлять часть буфера
+    // и восстанавливать содержимое при потере устройства.
+    vertexBuffer_->SetShadowed(true);
+
+    indexBuffer_ = new IndexBuffer(context_);
+}
+
+SpriteLayer::~SpriteLayer()
+{
+}
+
+unsigned SpriteLayer::AddSprite(Texture2D* texture, const Vector2& position, const Color& color/* = Color::WHITE*/,
+    float rotation/* = 0.0f*/, const Vector2& origin/* = Vector2::ZERO*/, float scale/* = 1.0f*/)
+{
+    IntRect sourceRect(0, 0, texture->GetWidth(), texture->GetHeight());
+    return AddSprite(texture, sourceRect, position, color, rotation, origin, scale);
+}
+
+unsigned SpriteLayer::AddSprite(Texture2D* texture, const IntRect& sourceRect, const Vector2& position,
+    const Color& color/* = Color::WHITE*/, float rotation/* = 0.0f*/, const Vector2& origin/* = Vector2::ZERO*/,
+    float scale/* = 1.0f*/)
+{
+    SpriteBatch::SBSprite sprite { texture, sourceRect, position, color, rotation, origin, scale, 0.0f, 0, nullptr,
+                                   nullptr, 0.0f };
+    sprites_.Push(sprite);
+
+    unsigned index = sprites_.Size() - 1;
+    MarkDirty(index);
+    portionsDirty_ = true;
+
+    return index;
+}
+
+void SpriteLayer::SetSprite(unsigned index, Texture2D* texture, const IntRect& sourceRect, const Vector2& position,
+    const Color& color/* = Color::WHITE*/, float rotation/* = 0.0f*/, const Vector2& origin/* = Vector2::ZERO*/,
+    float scale/* = 1.0f*/)
+{
+    SpriteBatch::SBSprite& sprite = sprites_[index];
+
+    // Порции зависят только от текстур.
+    if (sprite.texture_ != texture)
+        portionsDirty_ = true;
+
+    sprite = SpriteBatch::SBSprite { texture, sourceRect, position, color, rotation, origin, scale, 0.0f, 0, nullptr,
+                                     nullptr, 0.0f };
+    MarkDirty(index);
+}
+
+void SpriteLayer::SetSpritePosition(unsigned index, const Vector2& position)
+{
+    sprites_[index].position_ = position;
+    MarkDirty(index);
+}
+
+void SpriteLayer::SetSpriteColor(unsigned index, const Color& color)
+{
+    sprites_[index].color_ = color;
+    MarkDirty(index);
+}
+
+void SpriteLayer::SetSpriteRotation(unsigned index, float rotation)
+{
+    sprites_[index].rotation_ = rotation;
+    MarkDirty(index);
+}
+
+void SpriteLayer::Clear()
+{
+    sprites_.Clear();
+    portions_.Clear();
+    dirtyStart_ = M_MAX_UNSIGNED;
+    dirtyEnd_ = 0;
+    portionsDirty_ = false;
+}
+
+void SpriteLayer::MarkDirty(unsigned index)
+{
+    // Храним один диапазон, охватывающий все измененные спрайты. Обычно меняются
+    // спрайты, расположенные рядом (например, одна область тайловой карты).
+    dirtyStart_ = Min(dirtyStart_, index);
+    dirtyEnd_ = Max(dirtyEnd_, index + 1);
+}
+
+void SpriteLayer::UpdatePortions()
+{
+    portions_.Clear();
+
+    for (unsigned i = 0; i < sprites_.Size(); i++)
+    {
+        // Спрайт продолжает текущую порцию.
+        if (!portions_.Empty() && portions_.Back().texture_ == sprites_[i].texture_)
+        {
+            portions_.Back().count_++;
+            continue;
+        }
+
+        SLPortion portion { sprites_[i].texture_, i, 1 };
+        portions_.Push(portion);
+    }
+
+    portionsDirty_ = false;
+}
+
+void SpriteLayer::Update()
+{
+    if (sprites_.Empty())
+        return;
+
+    // Спрайты не помещаются в буферы. Увеличиваем их и заполняем заново.
+    if (sprites_.Size() > capacity_)
+    {
+        capacity_ = Max(capacity_ * 2, sprites_.Size());
+        SpriteBatch::SetVertexBufferSize(vertexBuffer_, capacity_, false);
+        SpriteBatch::FillIndexBuffer(indexBuffer_, capacity_);
+        MarkDirty(0);
+        MarkDirty(sprites_.Size() - 1);
+    }
+
+    if (portionsDirty_)
+        UpdatePortions();
+
+    // Нечего загружать.
+    if (dirtyStart_ >= dirtyEnd_)
+        return;
+
+    // Вершины вычисляются отдельно для каждой порции, так как у порций разные размеры текстур.
+    for (unsigned i = 0; i < portions_.Size(); i++)
+    {
+        const SLPortion& portion = portions_[i];
+        unsigned start = Max(portion.start_, dirtyStart_);
+        unsigned end = Min(portion.start_ + portion.count_, dirtyEnd_);
+
+        // Порция не пересекается с измененным диапазоном.
+        if (start >= end)
+            continue;
+
+        float invTextureW = 1.0f / portion.texture_->GetWidth();
+        float invTextureH = 1.0f / portion.texture_->GetHeight();
+
+        // Буфер не динамический и без discard, поэтому старое содержимое за пределами
+        // заблокированного диапазона сохраняется.
+        SBVertex* vertices = (SBVertex*)vertexBuffer_->Lock(start * VERTICES_PER_SPRITE, (end - start) * VERTICES_PER_SPRITE);
+        SpriteBatch::WriteVertices(vertices, sprites_.Buffer() + start, end - start, invTextureW, invTextureH);
+        vertexBuffer_->Unlock();
+    }
+
+    dirtyStart_ = M_MAX_UNSIGNED;
+    dirtyEnd_ = 0;
+}
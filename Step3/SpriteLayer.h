@@ -0,0 +1,81 @@
+﻿/*
+    Статический слой спрайтов (фоны, тайловые карты, неподвижный интерфейс). В отличие от SpriteBatch,
+    спрайты не добавляются заново каждый кадр: вершины вычисляются один раз и хранятся в видеопамяти.
+    Если какой-то спрайт изменился, в видеокарту загружается только измененный участок буфера.
+    Выводится слой с помощью SpriteBatch::RenderLayer().
+*/
+
+#pragma once
+
+#include "SpriteBatch.h"
+
+class SpriteLayer : public Object
+{
+    URHO3D_OBJECT(SpriteLayer, Object);
+
+public:
+    // Группа подряд идущих спрайтов с одинаковой текстурой, которая выводится за один драв колл.
+    struct SLPortion
+    {
+        Texture2D* texture_;
+        unsigned start_;
+        unsigned count_;
+    };
+
+    SpriteLayer(Context* context);
+    virtual ~SpriteLayer();
+
+    // Добавляет спрайт в слой и возвращает его номер. Параметры такие же, как у SpriteBatch::Draw().
+    unsigned AddSprite(Texture2D* texture, const Vector2& position, const Color& color = Color::WHITE,
+        float rotation = 0.0f, const Vector2& origin = Vector2::ZERO, float scale = 1.0f);
+    unsigned AddSprite(Texture2D* texture, const IntRect& sourceRect, const Vector2& position, const Color& color = Color::WHITE,
+        float rotation = 0.0f, const Vector2& origin = Vector2::ZERO, float scale = 1.0f);
+
+    // Полностью заменяет спрайт с номером index.
+    void SetSprite(unsigned index, Texture2D* texture, const IntRect& sourceRect, const Vector2& position,
+        const Color& color = Color::WHITE, float rotation = 0.0f, const Vector2& origin = Vector2::ZERO, float scale = 1.0f);
+
+    // Изменяют отдельные параметры спрайта.
+    void SetSpritePosition(unsigned index, const Vector2& position);
+    void SetSpriteColor(unsigned index, const Color& color);
+    void SetSpriteRotation(unsigned index, float rotation);
+
+    // Удаляет все спрайты.
+    void Clear();
+
+    unsigned GetNumSprites() const { return sprites_.Size(); }
+
+    // Загружает изменения в видеокарту. Вызывается автоматически в SpriteBatch::RenderLayer().
+    void Update();
+
+    VertexBuffer* GetVertexBuffer() const { return vertexBuffer_; }
+    IndexBuffer* GetIndexBuffer() const { return indexBuffer_; }
+    const PODVector<SLPortion>& GetPortions() const { return portions_; }
+
+private:
+    // Спрайты слоя. Нужны для пересчета вершин измененных спрайтов.
+    PODVector<SpriteBatch::SBSprite> sprites_;
+
+    // Порции, на которые делятся спрайты слоя. Пересчитываются только при смене текстур.
+    PODVector<SLPortion> portions_;
+
+    // Вершинный буфер не динамический, так как меняется редко.
+    SharedPtr<VertexBuffer> vertexBuffer_;
+    SharedPtr<IndexBuffer> indexBuffer_;
+
+    // Вместимость буферов (в спрайтах). Растет вдвое, когда спрайты перестают помещаться.
+    unsigned capacity_;
+
+    // Диапазон измененных спрайтов [dirtyStart_, dirtyEnd_), вершины которых нужно пересчитать.
+    unsigned dirtyStart_;
+    unsigned dirtyEnd_;
+
+    // Изменились текстуры или число спрайтов, и нужно заново разбить спрайты на порции.
+    bool portionsDirty_;
+
+    // Помечает спрайт как измененный.
+    void MarkDirty(unsigned index);
+
+    // Разбивает спрайты на порции.
+    void UpdatePortions();
+};
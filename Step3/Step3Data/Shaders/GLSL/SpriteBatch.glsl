@@ -0,0 +1,137 @@
+// Шейдер SpriteBatch. Дефайны:
+// INSTANCED - инстансинговый режим. Благодаря этому дефайну в Transform.glsl объявляются атрибуты iTexCoord4,
+// iTexCoord5 и iTexCoord6, которые берутся из буфера экземпляров (один набор на спрайт, а не на вершину).
+// Без него вершины спрайтов вычисляются на CPU, как для шейдера Basic.
+// MULTITEXTURE - режим нескольких текстур. К текстурной координате u прибавлен удвоенный номер текстуры (0 - 3),
+// а сами текстуры установлены в юниты sDiffMap, sNormalMap, sSpecMap и sEmissiveMap.
+// PARTICLES - частицы SpriteEmitter. Из буфера экземпляров берутся только случайные числа частицы (iTexCoord4),
+// а все остальное вычисляется из времени и параметров эмиттера (смотрите SpriteBatch::RenderEmitter()).
+
+#include "Uniforms.glsl"
+#include "Transform.glsl"
+#include "Samplers.glsl"
+
+#if defined(PARTICLES) && defined(COMPILEVS)
+    // Без дефайна INSTANCED атрибут в Transform.glsl не объявляется.
+    attribute vec4 iTexCoord4;
+
+    uniform vec4 cParticleTime;    // x - время с запуска эмиттера, y - время жизни частицы, z - длительность эмиссии.
+    uniform vec4 cParticleEmitter; // xy - позиция эмиттера, z - направление и w - разброс (в радианах).
+    uniform vec4 cParticleMotion;  // x, y - диапазон скорости, zw - ускорение.
+    uniform vec4 cParticleSize;    // xy - размер частицы в пикселях, z - начальный масштаб, w - конечный.
+    uniform vec4 cParticleSpin;    // x, y - диапазон скорости вращения (в радианах в секунду).
+    uniform vec4 cParticleUV;      // Текстурные координаты левого верхнего (xy) и правого нижнего (zw) углов.
+    uniform vec4 cParticleStartColor;
+    uniform vec4 cParticleEndColor;
+#endif
+
+varying vec4 vColor;
+varying vec2 vTexCoord;
+#ifdef MULTITEXTURE
+    varying float vTextureIndex;
+#endif
+
+void VS()
+{
+#if defined(PARTICLES)
+    // График жизни частицы повторяется с периодом lifetime. iTexCoord4.x - момент первого рождения
+    // в долях времени жизни, generation - номер текущей жизни частицы.
+    float lifetime = cParticleTime.y;
+    float sinceFirstBirth = cParticleTime.x - iTexCoord4.x * lifetime;
+    float generation = floor(sinceFirstBirth / lifetime);
+    float age = sinceFirstBirth - generation * lifetime;
+    float birth = cParticleTime.x - age;
+
+    // Еще не родившиеся частицы и частицы, рожденные после окончания испускания, получают нулевой размер.
+    float alive = sinceFirstBirth >= 0.0 && birth <= cParticleTime.z ? 1.0 : 0.0;
+
+    // Новые случайные числа для каждой жизни частицы: к исходным прибавляются иррациональные числа,
+    // так что значения не повторяются.
+    vec3 random = fract(iTexCoord4.yzw + generation * vec3(0.618034, 0.414214, 0.732051));
+    float lifeFraction = age / lifetime;
+
+    // Равноускоренное движение из точки эмиттера.
+    float angle = cParticleEmitter.z + (random.x * 2.0 - 1.0) * cParticleEmitter.w;
+    float speed = mix(cParticleMotion.x, cParticleMotion.y, random.y);
+    vec2 position = cParticleEmitter.xy + vec2(cos(angle), sin(angle)) * speed * age +
+                    0.5 * cParticleMotion.zw * age * age;
+
+    float rotation = random.z * 6.283185 + mix(cParticleSpin.x, cParticleSpin.y, random.z) * age;
+    float scale = mix(cParticleSize.z, cParticleSize.w, lifeFraction) * alive;
+
+    // Начало координат частицы - ее центр.
+    vec2 local = (iPos.xy - 0.5) * cParticleSize.xy * scale;
+    float s = sin(rotation);
+    float c = cos(rotation);
+    vec3 worldPos = vec3(position.x + local.x * c - local.y * s,
+                         position.y + local.x * s + local.y * c,
+                         0.0);
+    gl_Position = GetClipPos(worldPos);
+
+    vTexCoord = mix(cParticleUV.xy, cParticleUV.zw, iPos.xy);
+    vColor = mix(cParticleStartColor, cParticleEndColor, lifeFraction);
+#elif defined(INSTANCED)
+    // Вершинный буфер содержит единичный квадрат, iPos.xy - его угол: (0, 0), (1, 0), (1, 1) или (0, 1).
+    // Атрибуты спрайта:
+    // iTexCoord4.xy - позиция, iTexCoord4.zw - начало координат спрайта (origin),
+    // iTexCoord5.xy - размер в пикселях, iTexCoord5.z - угол поворота в радианах, iTexCoord5.w - масштаб,
+    // iTexCoord6 - текстурные координаты левого верхнего (xy) и правого нижнего (zw) углов,
+    // iColor - цвет спрайта.
+    vec2 position = iTexCoord4.xy;
+    vec2 origin = iTexCoord4.zw;
+    vec2 size = iTexCoord5.xy;
+    float rotation = iTexCoord5.z;
+    float scale = iTexCoord5.w;
+
+    // Та же трансформация, что и в SpriteBatch::RenderPortion(): сдвиг на -origin,
+    // масштабирование, вращение и перемещение в position.
+    vec2 local = (iPos.xy * size - origin) * scale;
+    float s = sin(rotation);
+    float c = cos(rotation);
+    vec3 worldPos = vec3(position.x + local.x * c - local.y * s,
+                         position.y + local.x * s + local.y * c,
+                         0.0);
+    gl_Position = GetClipPos(worldPos);
+
+    vTexCoord = mix(iTexCoord6.xy, iTexCoord6.zw, iPos.xy);
+#else
+    // Вершины уже в экранных координатах, матрица модели единичная.
+    mat4 modelMatrix = iModelMatrix;
+    vec3 worldPos = GetWorldPos(modelMatrix);
+    gl_Position = GetClipPos(worldPos);
+
+    vTexCoord = iTexCoord;
+#endif
+
+#ifndef PARTICLES
+    // У частиц нет атрибута цвета, их цвет вычислен выше.
+    vColor = iColor;
+#endif
+
+#ifdef MULTITEXTURE
+    // Координата u лежит в диапазоне [2 * номер, 2 * номер + 1]. Добавка 0.25 защищает от ошибок
+    // округления на границах диапазона. Номер одинаков для всех вершин спрайта, поэтому
+    // его можно вычислить здесь, а не в пиксельном шейдере.
+    vTextureIndex = floor(vTexCoord.x * 0.5 + 0.25);
+    vTexCoord.x -= 2.0 * vTextureIndex;
+#endif
+}
+
+void PS()
+{
+#ifdef MULTITEXTURE
+    // Индексировать массив сэмплеров переменной в GLSL ES нельзя, поэтому выбираем текстуру ветвлением.
+    vec4 diffColor;
+    if (vTextureIndex < 0.5)
+        diffColor = texture2D(sDiffMap, vTexCoord);
+    else if (vTextureIndex < 1.5)
+        diffColor = texture2D(sNormalMap, vTexCoord);
+    else if (vTextureIndex < 2.5)
+        diffColor = texture2D(sSpecMap, vTexCoord);
+    else
+        diffColor = texture2D(sEmissiveMap, vTexCoord);
+    gl_FragColor = vColor * diffColor;
+#else
+    gl_FragColor = vColor * texture2D(sDiffMap, vTexCoord);
+#endif
+}
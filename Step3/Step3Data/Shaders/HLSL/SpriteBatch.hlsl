@@ -0,0 +1,158 @@
+// Шейдер SpriteBatch. Дефайны:
+// INSTANCED - инстансинговый режим. Атрибуты TEXCOORD4 - TEXCOORD6 и COLOR0 берутся из буфера экземпляров
+// (один набор на спрайт, а не на вершину). Без него вершины спрайтов вычисляются на CPU, как для шейдера Basic.
+// MULTITEXTURE - режим нескольких текстур. К текстурной координате u прибавлен удвоенный номер текстуры (0 - 3),
+// а сами текстуры установлены в юниты DiffMap, NormalMap, SpecMap и EmissiveMap.
+// PARTICLES - частицы SpriteEmitter. Из буфера экземпляров берутся только случайные числа частицы (TEXCOORD4),
+// а все остальное вычисляется из времени и параметров эмиттера (смотрите SpriteBatch::RenderEmitter()).
+
+#include "Uniforms.hlsl"
+#include "Transform.hlsl"
+#include "Samplers.hlsl"
+
+#if defined(PARTICLES) && defined(COMPILEVS)
+// Параметры эмиттера. Описание - в шейдере GLSL. В Direct3D 11 собственные параметры
+// должны находиться в отдельном константном буфере (слоты b0 - b5 заняты параметрами движка).
+#ifndef D3D11
+uniform float4 cParticleTime;
+uniform float4 cParticleEmitter;
+uniform float4 cParticleMotion;
+uniform float4 cParticleSize;
+uniform float4 cParticleSpin;
+uniform float4 cParticleUV;
+uniform float4 cParticleStartColor;
+uniform float4 cParticleEndColor;
+#else
+cbuffer ParticleVS : register(b6)
+{
+    float4 cParticleTime;
+    float4 cParticleEmitter;
+    float4 cParticleMotion;
+    float4 cParticleSize;
+    float4 cParticleSpin;
+    float4 cParticleUV;
+    float4 cParticleStartColor;
+    float4 cParticleEndColor;
+}
+#endif
+#endif
+
+#line 40
+
+void VS(float4 iPos : POSITION,
+#if defined(PARTICLES)
+    // В Direct3D 11 шейдер не может объявлять атрибуты, которых нет в буферах.
+    float4 iTexCoord4 : TEXCOORD4,
+#elif defined(INSTANCED)
+    float4 iTexCoord4 : TEXCOORD4,
+    float4 iTexCoord5 : TEXCOORD5,
+    float4 iTexCoord6 : TEXCOORD6,
+#else
+    float2 iTexCoord : TEXCOORD0,
+#endif
+#ifndef PARTICLES
+    float4 iColor : COLOR0,
+#endif
+    out float4 oColor : COLOR0,
+    out float2 oTexCoord : TEXCOORD0,
+#ifdef MULTITEXTURE
+    out float oTextureIndex : TEXCOORD1,
+#endif
+    out float4 oPos : OUTPOSITION)
+{
+#if defined(PARTICLES)
+    // Та же формула, что и в шейдере GLSL.
+    float lifetime = cParticleTime.y;
+    float sinceFirstBirth = cParticleTime.x - iTexCoord4.x * lifetime;
+    float generation = floor(sinceFirstBirth / lifetime);
+    float age = sinceFirstBirth - generation * lifetime;
+    float birth = cParticleTime.x - age;
+    float alive = sinceFirstBirth >= 0.0 && birth <= cParticleTime.z ? 1.0 : 0.0;
+
+    float3 random = frac(iTexCoord4.yzw + generation * float3(0.618034, 0.414214, 0.732051));
+    float lifeFraction = age / lifetime;
+
+    float angle = cParticleEmitter.z + (random.x * 2.0 - 1.0) * cParticleEmitter.w;
+    float speed = lerp(cParticleMotion.x, cParticleMotion.y, random.y);
+    float2 direction;
+    sincos(angle, direction.y, direction.x);
+    float2 position = cParticleEmitter.xy + direction * speed * age + 0.5 * cParticleMotion.zw * age * age;
+
+    float rotation = random.z * 6.283185 + lerp(cParticleSpin.x, cParticleSpin.y, random.z) * age;
+    float scale = lerp(cParticleSize.z, cParticleSize.w, lifeFraction) * alive;
+
+    float2 local = (iPos.xy - 0.5) * cParticleSize.xy * scale;
+    float s, c;
+    sincos(rotation, s, c);
+    float3 worldPos = float3(position.x + local.x * c - local.y * s,
+                             position.y + local.x * s + local.y * c,
+                             0.0);
+    oPos = GetClipPos(worldPos);
+
+    oTexCoord = lerp(cParticleUV.xy, cParticleUV.zw, iPos.xy);
+    oColor = lerp(cParticleStartColor, cParticleEndColor, lifeFraction);
+#elif defined(INSTANCED)
+    // Вершинный буфер содержит единичный квадрат, iPos.xy - его угол: (0, 0), (1, 0), (1, 1) или (0, 1).
+    // Атрибуты спрайта:
+    // iTexCoord4.xy - позиция, iTexCoord4.zw - начало координат спрайта (origin),
+    // iTexCoord5.xy - размер в пикселях, iTexCoord5.z - угол поворота в радианах, iTexCoord5.w - масштаб,
+    // iTexCoord6 - текстурные координаты левого верхнего (xy) и правого нижнего (zw) углов.
+    float2 position = iTexCoord4.xy;
+    float2 origin = iTexCoord4.zw;
+    float2 size = iTexCoord5.xy;
+    float rotation = iTexCoord5.z;
+    float scale = iTexCoord5.w;
+
+    // Та же трансформация, что и в SpriteBatch::RenderPortion(): сдвиг на -origin,
+    // масштабирование, вращение и перемещение в position.
+    float2 local = (iPos.xy * size - origin) * scale;
+    float s, c;
+    sincos(rotation, s, c);
+    float3 worldPos = float3(position.x + local.x * c - local.y * s,
+                             position.y + local.x * s + local.y * c,
+                             0.0);
+    oPos = GetClipPos(worldPos);
+
+    oTexCoord = lerp(iTexCoord6.xy, iTexCoord6.zw, iPos.xy);
+#else
+    // Вершины уже в экранных координатах, матрица модели единичная.
+    float4x3 modelMatrix = iModelMatrix;
+    float3 worldPos = GetWorldPos(modelMatrix);
+    oPos = GetClipPos(worldPos);
+
+    oTexCoord = iTexCoord;
+#endif
+
+#ifndef PARTICLES
+    oColor = iColor;
+#endif
+
+#ifdef MULTITEXTURE
+    // Координата u лежит в диапазоне [2 * номер, 2 * номер + 1]. Добавка 0.25 защищает от ошибок округления.
+    oTextureIndex = floor(oTexCoord.x * 0.5 + 0.25);
+    oTexCoord.x -= 2.0 * oTextureIndex;
+#endif
+}
+
+void PS(float4 iColor : COLOR0,
+    float2 iTexCoord : TEXCOORD0,
+#ifdef MULTITEXTURE
+    float iTextureIndex : TEXCOORD1,
+#endif
+    out float4 oColor : OUTCOLOR0)
+{
+#ifdef MULTITEXTURE
+    float4 diffColor;
+    if (iTextureIndex < 0.5)
+        diffColor = Sample2D(DiffMap, iTexCoord);
+    else if (iTextureIndex < 1.5)
+        diffColor = Sample2D(NormalMap, iTexCoord);
+    else if (iTextureIndex < 2.5)
+        diffColor = Sample2D(SpecMap, iTexCoord);
+    else
+        diffColor = Sample2D(EmissiveMap, iTexCoord);
+    oColor = iColor * diffColor;
+#else
+    oColor = iColor * Sample2D(DiffMap, iTexCoord);
+#endif
+}